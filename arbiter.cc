@@ -1,97 +1,301 @@
 #include <assert.h>
+#include <ctype.h>
+#include <dlfcn.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <sstream>
+#include <thread>
 #include <utility>
 #include <vector>
 
-namespace {
+#include "flippo_dataset.h"
+#include "flippo_plugin.h"
+#include "flippo_rules.h"
 
-const int SIZE = 8;
-const int MAX_MOVES = 60;
+namespace {
 
-struct State {
-  char fields[SIZE][SIZE];
-  int moves_played;
-};
+using namespace flippo;
 
-struct Move {
-  int row;
-  int col;
-};
+// Game logic is in flippo_rules.h. Arbiter logic follows.
 
-bool operator==(const Move &a, const Move &b) {
-  return a.row == b.row && a.col == b.col;
+/*
+double GetWallTime() {
+  struct timeval tv;
+  int res = gettimeofday(&tv, NULL);
+  assert(res == 0);
+  return tv.tv_sec + tv.tv_usec*1e-6;
 }
+*/
 
-State InitialState() {
-  State state = {{}, 0};
-  state.fields[SIZE/2 - 1][SIZE/2 - 1] = 1;
-  state.fields[SIZE/2 - 1][SIZE/2 - 0] = 2;
-  state.fields[SIZE/2 - 0][SIZE/2 - 1] = 2;
-  state.fields[SIZE/2 - 0][SIZE/2 - 0] = 1;
-  return state;
+double GetMonotonicTime() {
+  struct timespec ts;
+  int res = clock_gettime(CLOCK_MONOTONIC, &ts);
+  assert(res == 0);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
 }
 
-bool ValidCoords(int r, int c) {
-  return 0 <= r && r < SIZE && 0 <= c && c < SIZE;
+// A copy of a player plugin (see flippo_plugin.h), with its own globals.
+struct Plugin {
+  std::string path;
+  flippo_new_game_fn *new_game;
+  flippo_opponent_move_fn *opponent_move;
+  flippo_select_move_fn *select_move;
+  flippo_free_game_fn *free_game;
+};
+
+// Loaded plugin copies that aren't playing a game, by path.
+std::mutex plugins_mutex;
+std::map<std::string, std::vector<Plugin*>> idle_plugins;
+
+template<class Function>
+Function *LoadSymbol(void *handle, const std::string &path, const char *name) {
+  void *symbol = dlsym(handle, name);
+  if (symbol == nullptr) {
+    fprintf(stderr, "Plugin %s does not define %s!\n", path.c_str(), name);
+    exit(1);
+  }
+  return reinterpret_cast<Function*>(symbol);
 }
 
-int CalculateScore(const State &state) {
-  int scores[3] = {0, 0, 0};
-  for (int r = 0; r < SIZE; ++r) {
-    for (int c = 0; c < SIZE; ++c) {
-      ++scores[int{state.fields[r][c]}];
+// Loads another copy of the shared library at `path`. The dynamic linker loads
+// each file only once, so the copy is loaded from a copy of the file in memory.
+// (Unlike dlmopen(), this keeps a single C library, which the plugin's threads
+// need.)
+void *OpenLibraryCopy(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    perror(path.c_str());
+    exit(1);
+  }
+  int fd_copy = memfd_create("flippo-plugin", MFD_CLOEXEC);
+  if (fd_copy < 0) {
+    perror("memfd_create()");
+    exit(1);
+  }
+  char buf[1 << 16];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      perror("read()");
+      exit(1);
     }
+    for (ssize_t pos = 0; pos < n; ) {
+      ssize_t m = write(fd_copy, buf + pos, n - pos);
+      if (m < 0 && errno != EINTR) {
+        perror("write()");
+        exit(1);
+      }
+      if (m > 0) pos += m;
+    }
+  }
+  close(fd);
+  const std::string copy_path = "/proc/self/fd/" + std::to_string(fd_copy);
+  void *handle = dlopen(copy_path.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (handle == nullptr) {
+    fprintf(stderr, "Cannot load plugin %s: %s\n", path.c_str(), dlerror());
+    exit(1);
   }
-  return scores[1] - scores[2];
+  // Keep the copy's descriptor open: the dynamic linker identifies loaded
+  // libraries by name, so a later copy whose descriptor reused this number
+  // would get this copy instead of its own.
+  return handle;
 }
 
-// End of game logic. Arbiter logic follows.
+// Returns a copy of the plugin at `path` that isn't playing a game, loading a
+// new copy if necessary. Copies are returned with ReleasePlugin().
+Plugin *AcquirePlugin(const std::string &path) {
+  std::lock_guard<std::mutex> lock(plugins_mutex);
+  std::vector<Plugin*> &idle = idle_plugins[path];
+  if (!idle.empty()) {
+    Plugin *plugin = idle.back();
+    idle.pop_back();
+    return plugin;
+  }
+  void *handle = OpenLibraryCopy(path);
+  int version = LoadSymbol<flippo_plugin_version_fn>(handle, path, "flippo_plugin_version")();
+  if (version != FLIPPO_PLUGIN_VERSION) {
+    fprintf(stderr, "Plugin %s has version %d; expected %d!\n",
+        path.c_str(), version, FLIPPO_PLUGIN_VERSION);
+    exit(1);
+  }
+  return new Plugin{path,
+      LoadSymbol<flippo_new_game_fn>(handle, path, "flippo_new_game"),
+      LoadSymbol<flippo_opponent_move_fn>(handle, path, "flippo_opponent_move"),
+      LoadSymbol<flippo_select_move_fn>(handle, path, "flippo_select_move"),
+      LoadSymbol<flippo_free_game_fn>(handle, path, "flippo_free_game")};
+}
 
+void ReleasePlugin(Plugin *plugin) {
+  std::lock_guard<std::mutex> lock(plugins_mutex);
+  idle_plugins[plugin->path].push_back(plugin);
+}
+
+// A player process, or a plugin playing in the arbiter's process.
 struct Player {
   const int fd_in;
   const int fd_out;
   const pid_t pid;
+  const bool has_cpu_clock;
+  // CPU-time clock of process `pid`, or for a plugin, of the thread calling it
+  const clockid_t cpu_clock;
+  Plugin *const plugin;  // null for player processes
+  void *const game;      // game instance of `plugin`
+  std::string input;  // data read from fd_out, not yet returned by ReadLine()
+  double plugin_cpu_time;  // CPU time spent in calls to `plugin`
+  double cpu_time_base;  // GetCpuTime() at the start of the current game
+  bool features_read;     // the feature announcement was read, if any
+  bool supports_reset;    // features announced by the player
+  bool supports_opening;
 };
 
-std::string ReadLine(Player &player) {
-  // In theory, the player is allowed to write less or more than one line at a
-  // time. However, we currently don't support that. We expect to read exactly
-  // one line at a time; nothing more, nothing less.
-  char buf[1024];
-  ssize_t n = read(player.fd_out, buf, sizeof(buf));
+// Protocol extensions that the arbiter offers to player processes, in the
+// environment variable FLIPPO_ARBITER_FEATURES. A player announces the ones it
+// supports by writing a line "Features <name> ..." before anything else.
+//
+// reset: after a regular game end, the process may be kept instead of being
+// sent "Quit", to play a later game with the same command. That game starts
+// with "Reset <log file>": the player starts a new game, and writes its log
+// (stderr) to the given file from then on. "Quit" is only sent at the end of
+// the match.
+//
+// opening: before a game, the arbiter may send "Opening <moves>", with the
+// moves encoded as by EncodeHistory(), which the player plays for both sides.
+// Then the player to move is sent "Start" as usual.
+const char *const ARBITER_FEATURES = "reset opening";
+
+// Returns the CPU time (user + system, all threads) used by the player process
+// so far, or for a plugin the CPU time used by the calling thread, or 0 if
+// unavailable.
+double GetCpuTime(const Player &player) {
+  struct timespec ts;
+  if (!player.has_cpu_clock || clock_gettime(player.cpu_clock, &ts) != 0) {
+    return 0.0;
+  }
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// Resource usage of an exited player, including processes it waited for.
+struct ProcessUsage {
+  double cpu_time = 0.0;  // user + system time in seconds
+  long max_rss_kb = 0;    // peak resident set size in KiB
+};
+
+// Longest line accepted from a player, to limit buffering.
+const size_t MAX_LINE_LENGTH = 1 << 16;
+
+// Converts the time until `deadline` to a poll() timeout in milliseconds,
+// rounded up, or -1 if the deadline is infinite.
+int PollTimeout(double deadline) {
+  if (std::isinf(deadline)) return -1;
+  double ms = ceil((deadline - GetMonotonicTime())*1e3);
+  return ms < 0 ? 0 : ms > 1e9 ? 1e9 : static_cast<int>(ms);
+}
+
+// Returns the next line written by the player (without the end-of-line), or
+// an empty string on error or if the line wasn't complete before `deadline`.
+// The player may write less or more than one line at a time: data after the
+// end of line is kept for the next call.
+std::string ReadLine(Player &player, double deadline = INFINITY) {
   std::string line;
-  if (n < 0) {
-    perror("read()");
+  if (player.plugin != nullptr) {
+    // The plugin runs on this thread, so the deadline is only checked by the
+    // caller, after the plugin has returned a move.
+    const double cpu_start = GetCpuTime(player);
+    int row, col;
+    if (player.plugin->select_move(player.game, &row, &col)) {
+      line += char('A' + row);
+      line += char('1' + col);
+    }
+    player.plugin_cpu_time += GetCpuTime(player) - cpu_start;
     return line;
   }
-  if (n == 0) {
-    fprintf(stderr, "End of file reached!\n");
-    return line;
+  for (;;) {
+    size_t end = player.input.find('\n');
+    if (end != std::string::npos) {
+      line.assign(player.input, 0, end);
+      player.input.erase(0, end + 1);
+      return line;
+    }
+    if (player.input.size() > MAX_LINE_LENGTH) {
+      fprintf(stderr, "End of line not found!\n");
+      return line;
+    }
+    struct pollfd pfd = {player.fd_out, POLLIN, 0};
+    int res = poll(&pfd, 1, PollTimeout(deadline));
+    if (res < 0) {
+      if (errno == EINTR) continue;
+      perror("poll()");
+      return line;
+    }
+    if (res == 0) {
+      fprintf(stderr, "Time limit exceeded!\n");
+      return line;
+    }
+    char buf[4096];
+    ssize_t n = read(player.fd_out, buf, sizeof(buf));
+    if (n < 0) {
+      if (errno == EINTR || errno == EAGAIN) continue;
+      perror("read()");
+      return line;
+    }
+    if (n == 0) {
+      fprintf(stderr, "End of file reached!\n");
+      return line;
+    }
+    player.input.append(buf, n);
   }
-  char *p = reinterpret_cast<char*>(memchr(buf, '\n', n));
-  if (p == NULL) {
-    fprintf(stderr, "End of line not found!\n");
-    return line;
+}
+
+// Reads the player's feature announcement (see ARBITER_FEATURES), if not done
+// yet. If the first line isn't one, it's kept for the next ReadLine(). Returns
+// false if no line could be read before `deadline`.
+bool ReadFeatures(Player &player, double deadline) {
+  if (player.features_read || player.plugin != nullptr) return true;
+  std::string line = ReadLine(player, deadline);
+  if (line.empty()) return false;
+  player.features_read = true;
+  if (line.compare(0, 9, "Features ") != 0) {
+    player.input.insert(0, line + '\n');
+    return true;
   }
-  if (p != buf + n - 1) {
-    fprintf(stderr, "Extra data after end of line found!\n");
-    return line;
+  std::istringstream iss(line.substr(9));
+  std::string feature;
+  while (iss >> feature) {
+    if (feature == "reset") player.supports_reset = true;
+    if (feature == "opening") player.supports_opening = true;
   }
-  line.assign(buf, n - 1);
-  return line;
+  return true;
+}
+
+// Returns the next line written by the player, like ReadLine(), after reading
+// the feature announcement, if any.
+std::string ReadMove(Player &player, double deadline) {
+  if (!ReadFeatures(player, deadline)) return std::string();
+  return ReadLine(player, deadline);
 }
 
 // Returns a copy of `s` with all non-ASCII characters escaped, using C-style
@@ -117,32 +321,138 @@ std::string EscapeString(const std::string &s) {
   return t;
 }
 
+// Writes `s` to the player. SIGPIPE must be ignored (see main()), so that
+// writing to a player that has exited fails instead of killing the arbiter.
 bool Write(Player &player, const std::string &s) {
-  // Temporarily ignore SIGPIPE to avoid aborting the process if the write
-  // fails. This makes this function non-thread-safe!
-  void (*old_handler)(int) = signal(SIGPIPE, SIG_IGN);
-  ssize_t size_written = write(player.fd_in, s.data(), s.size());
-  signal(SIGPIPE, old_handler);
-  return size_written == static_cast<ssize_t>(s.size());
+  if (player.plugin != nullptr) {
+    // A plugin that is asked for a move before receiving one plays white, so
+    // "Start" needs no call. Anything else must be a move.
+    if (s == "Start\n") return true;
+    if (s.size() != 3 || s[2] != '\n') return false;
+    const double cpu_start = GetCpuTime(player);
+    bool ok = player.plugin->opponent_move(player.game, s[0] - 'A', s[1] - '1');
+    player.plugin_cpu_time += GetCpuTime(player) - cpu_start;
+    return ok;
+  }
+  size_t pos = 0;
+  while (pos < s.size()) {
+    ssize_t n = write(player.fd_in, s.data() + pos, s.size() - pos);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    pos += n;
+  }
+  return true;
 }
 
-void Quit(Player &player) {
+// Time a player gets to exit after receiving "Quit", before it is killed.
+const double QUIT_GRACE_TIME = 2.0;
+
+ProcessUsage Quit(Player &player) {
+  ProcessUsage usage;
+  if (player.plugin != nullptr) {
+    // The plugin's memory can't be told apart from the arbiter's, so only
+    // the CPU time is reported.
+    player.plugin->free_game(player.game);
+    ReleasePlugin(player.plugin);
+    usage.cpu_time = player.plugin_cpu_time;
+    return usage;
+  }
   Write(player, "Quit\n");  // may fail if player has already exited
   close(player.fd_in);
+  // Discard remaining output while waiting, so the player can't block on a
+  // full pipe. A player that hasn't exited after the grace time (e.g., because
+  // it exceeded its time limit and is still thinking) is killed, along with
+  // any processes it started.
+  const double deadline = GetMonotonicTime() + QUIT_GRACE_TIME;
+  bool output_closed = false;
   int status = 0;
-  if (waitpid(player.pid, &status, 0) != player.pid) {
-    perror("waitpid");
-  } else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
-    fprintf(stderr, "Player did not exit normally! status=%d\n", status);
+  struct rusage rusage = {};
+  pid_t res;
+  while ((res = wait4(player.pid, &status, WNOHANG, &rusage)) == 0) {
+    if (GetMonotonicTime() > deadline) {
+      fprintf(stderr, "Player did not quit in time! Killing it.\n");
+      kill(-player.pid, SIGKILL);
+      res = wait4(player.pid, &status, 0, &rusage);
+      break;
+    }
+    if (output_closed) {
+      usleep(1000);
+      continue;
+    }
+    struct pollfd pfd = {player.fd_out, POLLIN, 0};
+    if (poll(&pfd, 1, std::min(PollTimeout(deadline), 10)) > 0) {
+      char buf[4096];
+      const ssize_t n = read(player.fd_out, buf, sizeof(buf));
+      output_closed = n == 0 || (n < 0 && errno != EINTR);
+    }
+  }
+  if (res != player.pid) {
+    perror("wait4");
+  } else {
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "Player did not exit normally! status=%d\n", status);
+    }
+    usage.cpu_time =
+        rusage.ru_utime.tv_sec + rusage.ru_utime.tv_usec*1e-6 +
+        rusage.ru_stime.tv_sec + rusage.ru_stime.tv_usec*1e-6;
+    usage.max_rss_kb = rusage.ru_maxrss;
   }
   close(player.fd_out);
+  return usage;
+}
+
+// Returns true if `command` runs a plugin rather than a process: if its first
+// word names a shared library (ending in ".so"). The remaining words are
+// passed to the plugin as arguments.
+bool ParsePluginCommand(const char *command, std::string *path, std::string *args) {
+  std::istringstream iss(command);
+  if (!(iss >> *path) || path->size() < 3 ||
+      path->compare(path->size() - 3, 3, ".so") != 0) {
+    return false;
+  }
+  std::getline(iss, *args);
+  return true;
+}
+
+Player SpawnPlugin(const std::string &path, const std::string &args,
+    const char *log_filename) {
+  Plugin *plugin = AcquirePlugin(path);
+  void *game = plugin->new_game(args.c_str(), log_filename);
+  if (game == nullptr) {
+    fprintf(stderr, "Plugin %s rejected arguments [%s]!\n", path.c_str(), args.c_str());
+    exit(1);
+  }
+  clockid_t cpu_clock;
+  bool has_cpu_clock = pthread_getcpuclockid(pthread_self(), &cpu_clock) == 0;
+  Player player = { -1, -1, -1, has_cpu_clock, cpu_clock, plugin, game };
+  return player;
 }
 
 Player SpawnPlayer(const char *command, const char *log_filename) {
+  std::string plugin_path, plugin_args;
+  if (ParsePluginCommand(command, &plugin_path, &plugin_args)) {
+    return SpawnPlugin(plugin_path, plugin_args, log_filename);
+  }
+  // Let the shell replace itself with simple commands, so the player's
+  // process is the engine itself, and its CPU-time clock measures the engine
+  // (which matters for reused players, see ReleasePlayer()). An '=' only
+  // makes a command special in its first word, as a variable assignment.
+  std::string shell_command = command;
+  const char *first_word = command + strspn(command, " \t");
+  const char *first_word_end = first_word + strcspn(first_word, " \t");
+  if (strpbrk(command, ";&|<>()$`\\\"'*?[#~\n") == nullptr &&
+      std::find(first_word, first_word_end, '=') == first_word_end) {
+    shell_command = "exec " + shell_command;
+  }
+  // The pipes are created close-on-exec, so that players spawned concurrently
+  // for other games don't inherit them (which would prevent end-of-file from
+  // being detected). dup2() clears the flag for the child's stdin/stdout.
   int pipe_in[2];
   int pipe_out[2];
-  if (pipe(pipe_in) != 0 || pipe(pipe_out) != 0) {
-    perror("pipe()");
+  if (pipe2(pipe_in, O_CLOEXEC) != 0 || pipe2(pipe_out, O_CLOEXEC) != 0) {
+    perror("pipe2()");
     exit(1);
   }
   pid_t pid = fork();
@@ -151,7 +461,9 @@ Player SpawnPlayer(const char *command, const char *log_filename) {
     exit(1);
   }
   if (pid == 0) {
-    // Child process.
+    // Child process. It gets its own process group, so Quit() can kill all
+    // processes started by the player command.
+    setpgid(0, 0);
     if (dup2(pipe_in[0], 0) != 0 || dup2(pipe_out[1], 1) != 1) {
       perror("dup2()");
       exit(1);
@@ -170,7 +482,7 @@ Player SpawnPlayer(const char *command, const char *log_filename) {
       perror("close()");
       exit(1);
     }
-    execl("/bin/sh", "/bin/sh", "-c", command, NULL);
+    execl("/bin/sh", "/bin/sh", "-c", shell_command.c_str(), NULL);
     perror("exec");
     exit(1);
   } else {
@@ -179,143 +491,99 @@ Player SpawnPlayer(const char *command, const char *log_filename) {
       perror("close()");
       exit(1);
     }
-    Player player = { pipe_in[1], pipe_out[0], pid };
+    clockid_t cpu_clock;
+    bool has_cpu_clock = clock_getcpuclockid(pid, &cpu_clock) == 0;
+    Player player = { pipe_in[1], pipe_out[0], pid, has_cpu_clock, cpu_clock, nullptr, nullptr };
     return player;
   }
 }
 
-struct PlayerQuitter {
-  PlayerQuitter(Player &player) : player(player) {}
-  ~PlayerQuitter() { Quit(player); }
-
-private:
-  PlayerQuitter(const PlayerQuitter&) = delete;
-  void operator=(const PlayerQuitter&) = delete;
-
-  Player &player;
-};
-
-bool IsGameOver(const State &state) {
-  return state.moves_played >= MAX_MOVES;
-}
+// Player processes waiting for their next game, by command (see the "reset"
+// feature in ARBITER_FEATURES).
+std::mutex idle_players_mutex;
+std::map<std::string, std::vector<Player>> idle_players;
 
-int GetNextPlayer(const State &state) {
-  return state.moves_played & 1;
-}
-
-std::string FormatMove(const Move &move) {
-  std::string s(2, '\0');
-  s[0] = 'A' + move.row;
-  s[1] = '1' + move.col;
-  return s;
-}
-
-bool ParseMove(const std::string &s, Move *move) {
-  if (s.size() != 2) {
-    return false;
+// Returns the peak resident set size of a running process in KiB, or 0 if
+// unavailable.
+long PeakRssKb(pid_t pid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/status", int(pid));
+  FILE *fp = fopen(path, "r");
+  if (fp == nullptr) {
+    return 0;
   }
-  int row = s[0] - 'A';
-  int col = s[1] - '1';
-  if (!ValidCoords(row, col)) {
-    return false;
+  char line[256];
+  long kb = 0;
+  while (fgets(line, sizeof(line), fp) != nullptr && sscanf(line, "VmHWM: %ld", &kb) != 1) {
   }
-  move->row = row;
-  move->col = col;
-  return true;
+  fclose(fp);
+  return kb;
 }
 
-bool HasOccupiedNeighbor(const State &state, int r, int c) {
-  for (int r2 = r - 1; r2 <= r + 1; ++r2) {
-    for (int c2 = c - 1; c2 <= c + 1; ++c2) {
-      if ((r2 != r || c2 != c) && ValidCoords(r2, c2) && state.fields[r2][c2] != 0) {
-        return true;
-      }
+// Returns a player process for `command` that is waiting for its next game,
+// after resetting it to log to `log_filename`, or spawns a new player.
+Player AcquirePlayer(const char *command, const char *log_filename) {
+  std::unique_lock<std::mutex> lock(idle_players_mutex);
+  std::vector<Player> &idle = idle_players[command];
+  while (!idle.empty()) {
+    Player player = idle.back();
+    idle.pop_back();
+    lock.unlock();
+    if (Write(player, std::string("Reset ") + log_filename + '\n')) {
+      player.cpu_time_base = GetCpuTime(player);
+      return player;
     }
+    Quit(player);  // it has exited since its last game
+    lock.lock();
   }
-  return false;
+  lock.unlock();
+  return SpawnPlayer(command, log_filename);
 }
 
-// Finds coordinates of pieces to be flipped.
-//
-// Callback should act like a bool(*)(int, int), and return `true` to continue
-// finding flipped pieces or `false` to abort the search.
-//
-// FindFlips() returns false if the search was aborted, true otherwise (i.e.,
-// no flips were found, or all callback invocations returned true.)
-template<class Callback>
-bool FindFlips(const State &state, int player, int r, int c, Callback callback) {
-  for (int dr = -1; dr <= 1; ++dr) {
-    for (int dc = -1; dc <=1; ++dc) {
-      if (dr != 0 || dc != 0) {
-        int last_n = 0;
-        for (int n = 1; ; ++n) {
-          const int r2 = r + n*dr;
-          const int c2 = c + n*dc;
-          if (!ValidCoords(r2, c2) || state.fields[r2][c2] == 0) {
-            break;
-          }
-          if (state.fields[r2][c2] == player) {
-            last_n = n;
-          }
-        }
-        for (int n = 1; n < last_n; ++n) {
-          if (!callback(r + n*dr, c + n *dc)) {
-            return false;
-          }
-        }
-      }
-    }
+// Ends the player's game, and returns its resource usage during the game. If
+// `reuse` is true and the player supports it, the player is kept for the next
+// game with the same command (see AcquirePlayer()), and its usage only covers
+// its main process. Otherwise, it quits.
+ProcessUsage ReleasePlayer(Player &player, const char *command, bool reuse) {
+  ProcessUsage usage;
+  if (reuse && player.supports_reset) {
+    usage.cpu_time = GetCpuTime(player) - player.cpu_time_base;
+    usage.max_rss_kb = PeakRssKb(player.pid);
+    std::lock_guard<std::mutex> lock(idle_players_mutex);
+    idle_players[command].push_back(player);
+    return usage;
   }
-  return true;
+  usage = Quit(player);
+  usage.cpu_time -= player.cpu_time_base;
+  return usage;
 }
 
-std::vector<Move> ListValidMoves(const State &state) {
-  std::vector<Move> all_moves;
-  const int player = (state.moves_played & 1) + 1;
-  for (int r = 0; r < SIZE; ++r) {
-    for (int c = 0; c < SIZE; ++c) {
-      if (state.fields[r][c] == 0 && HasOccupiedNeighbor(state, r, c)) {
-        all_moves.push_back(Move{r, c});
-      }
-    }
-  }
-  std::vector<Move> flipping_moves;
-  for (const Move &move : all_moves) {
-    if (!FindFlips(state, player, move.row, move.col, [](int, int) { return false; })) {
-      flipping_moves.push_back(move);
+// Sends "Quit" to the player processes kept for further games.
+void QuitIdlePlayers() {
+  std::lock_guard<std::mutex> lock(idle_players_mutex);
+  for (auto &entry : idle_players) {
+    for (Player &player : entry.second) {
+      Quit(player);
     }
   }
-  if (flipping_moves.empty()) {
-    return all_moves;
-  } else {
-    return flipping_moves;
-  }
+  idle_players.clear();
 }
 
-bool ValidateMove(const State &state, const Move &move, std::string *reason = nullptr) {
-  std::vector<Move> valid_moves = ListValidMoves(state);
-  if (std::find(valid_moves.begin(), valid_moves.end(), move) == valid_moves.end()) {
-    if (reason != nullptr) {
-      *reason = "Valid moves:";
-      for (const Move &move : valid_moves) {
-        *reason += ' ';
-        *reason += FormatMove(move);
-      }
-    }
-    return false;
-  } else {
+// Returns true if `move` is valid. Otherwise, the valid moves are listed in
+// `reason`.
+bool ValidateMove(const Position &position, const Move &move, std::string *reason = nullptr) {
+  const Bitboard valid_moves = ValidMoves(position);
+  if (valid_moves & Bit(move)) {
     return true;
   }
-}
-
-void ExecuteMove(State &state, const Move &move) {
-  const int player = (state.moves_played & 1) + 1;
-  FindFlips(state, player, move.row, move.col, [&state](int r, int c) {
-    state.fields[r][c] ^= 3;
-    return true;
-  });
-  state.fields[move.row][move.col] = player;
-  state.moves_played += 1;
+  if (reason != nullptr) {
+    *reason = "Valid moves:";
+    for (Bitboard b = valid_moves; b; b &= b - 1) {
+      *reason += ' ';
+      *reason += FormatMove(FieldMove(__builtin_ctzll(b)));
+    }
+  }
+  return false;
 }
 
 std::string EncodeHistory(const std::vector<Move> &moves) {
@@ -327,53 +595,148 @@ std::string EncodeHistory(const std::vector<Move> &moves) {
   return s;
 }
 
-/*
-double GetWallTime() {
-  struct timeval tv;
-  int res = gettimeofday(&tv, NULL);
-  assert(res == 0);
-  return tv.tv_sec + tv.tv_usec*1e-6;
+// The inverse of EncodeHistory(), for histories it produced.
+std::vector<Move> DecodeHistory(const std::string &s) {
+  std::vector<Move> moves;
+  for (size_t i = 0; i + 2 <= s.size(); i += 2) {
+    Move move;
+    if (ParseMove(s.substr(i, 2), &move)) moves.push_back(move);
+  }
+  return moves;
 }
-*/
 
-double GetMonotonicTime() {
-  struct timespec ts;
-  int res = clock_gettime(CLOCK_MONOTONIC, &ts);
-  assert(res == 0);
-  return ts.tv_sec + ts.tv_nsec*1e-9;
+// Time a player process gets to announce its features, when they must be
+// known before the game starts.
+const double FEATURES_TIMEOUT = 10.0;
+
+// Sends the opening `moves` to the player, to be played for both sides. A
+// plugin receives them as opponent moves: it plays for whichever side is to
+// move when it's asked for a move. A process must support the opening feature
+// (see ARBITER_FEATURES).
+bool SendOpening(Player &player, const std::vector<Move> &moves) {
+  if (player.plugin != nullptr) {
+    for (const Move &move : moves) {
+      if (!Write(player, FormatMove(move) + '\n')) return false;
+    }
+    return true;
+  }
+  if (!ReadFeatures(player, GetMonotonicTime() + FEATURES_TIMEOUT) || !player.supports_opening) {
+    fprintf(stderr, "Player does not support the opening feature!\n");
+    return false;
+  }
+  return Write(player, "Opening " + EncodeHistory(moves) + '\n');
+}
+
+// Reads opening transcripts, encoded as by EncodeHistory(), one per line.
+// Empty lines and lines starting with '#' are ignored. Exits on errors.
+std::vector<std::vector<Move>> ReadOpenings(const char *filename) {
+  FILE *fp = fopen(filename, "r");
+  if (fp == nullptr) {
+    perror(filename);
+    exit(1);
+  }
+  std::vector<std::vector<Move>> openings;
+  char buf[1024];
+  int line_number = 0;
+  while (fgets(buf, sizeof(buf), fp) != nullptr) {
+    ++line_number;
+    std::string line = buf;
+    while (!line.empty() && isspace(static_cast<unsigned char>(line.back()))) line.pop_back();
+    if (line.empty() || line[0] == '#') continue;
+    Position position = InitialPosition();
+    std::vector<Move> opening;
+    bool valid = line.size() % 2 == 0 && line.size()/2 < size_t(MAX_MOVES);
+    for (size_t i = 0; valid && i < line.size(); i += 2) {
+      Move move;
+      valid = ParseMove(line.substr(i, 2), &move) && ValidateMove(position, move);
+      if (valid) {
+        ExecuteMove(&position, move);
+        opening.push_back(move);
+      }
+    }
+    if (!valid) {
+      fprintf(stderr, "%s:%d: invalid opening %s!\n",
+          filename, line_number, EscapeString(line).c_str());
+      exit(1);
+    }
+    openings.push_back(opening);
+  }
+  fclose(fp);
+  if (openings.empty()) {
+    fprintf(stderr, "%s: no openings!\n", filename);
+    exit(1);
+  }
+  return openings;
 }
 
+// Time limits in seconds (infinite by default). A player that exceeds either
+// limit forfeits the game.
+struct TimeControl {
+  double move_time = INFINITY;  // per move
+  double game_time = INFINITY;  // per player per game
+};
+
 struct GameResult {
   std::string transcript;
   int score;
   double walltime_used[2];
+  double cputime_used[2];          // during the game, including startup of a new process
+  long max_rss_kb[2];
+  std::vector<double> move_times;  // wall time per move, in order of play
+  std::vector<double> move_cpu_times;  // CPU time per move, in order of play
+  int opening_length;  // moves at the start of `transcript` that weren't played live
+  bool completed;      // the game ended regularly, rather than by a failure
 };
 
 GameResult RunGame(const char *command_player1, const char *command_player2,
-    const char *log_filename1, const char *log_filename2) {
+    const char *log_filename1, const char *log_filename2,
+    const TimeControl &time_control, const std::vector<Move> &opening) {
   Player players[2] = {
-    SpawnPlayer(command_player1, log_filename1),
-    SpawnPlayer(command_player2, log_filename2)};
-  PlayerQuitter quit1(players[0]);
-  PlayerQuitter quit2(players[1]);
+    AcquirePlayer(command_player1, log_filename1),
+    AcquirePlayer(command_player2, log_filename2)};
 
-  State state = InitialState();
-  std::vector<Move> history;
+  Position position = InitialPosition();
+  std::vector<Move> history = opening;
+  for (const Move &move : opening) {
+    ExecuteMove(&position, move);
+  }
+  if (!opening.empty()) {
+    for (int i = 0; i < 2; ++i) {
+      if (!SendOpening(players[i], opening)) {
+        fprintf(stderr, "Could not send the opening to player %d!\n", i);
+        exit(1);
+      }
+    }
+  }
+  std::vector<double> move_times;
+  std::vector<double> move_cpu_times;
+  double cpu_start[2] = {GetCpuTime(players[0]), GetCpuTime(players[1])};
   double time_used[2] = {0.0, 0.0};
   double time_start = GetMonotonicTime();
   bool started = false;
-  while (!IsGameOver(state)) {
-    const int next_player = GetNextPlayer(state);
+  while (!IsGameOver(position)) {
+    const int next_player = NextPlayer(position);
     assert(next_player == 0 || next_player == 1);
     if (!started) {
-      if (!Write(players[0], "Start\n")) {
+      if (!Write(players[next_player], "Start\n")) {
         fprintf(stderr, "Could not send 'Start' to player %d!\n", next_player);
         break;
       }
       started = true;
     }
-    std::string line = ReadLine(players[next_player]);
-    time_used[next_player] += GetMonotonicTime() - time_start;
+    const double deadline = time_start + std::min(time_control.move_time,
+        time_control.game_time - time_used[next_player]);
+    std::string line = ReadMove(players[next_player], deadline);
+    const double move_time = GetMonotonicTime() - time_start;
+    const double cpu_time = GetCpuTime(players[next_player]);
+    time_used[next_player] += move_time;
+    if (GetMonotonicTime() > deadline) {
+      fprintf(stderr, "Player %d exceeded the time limit (%.3f s for the move, %.3f s in total)!\n",
+          next_player, move_time, time_used[next_player]);
+      break;
+    }
+    move_times.push_back(move_time);
+    move_cpu_times.push_back(cpu_time - cpu_start[next_player]);
     Move move;
     if (!ParseMove(line, &move)) {
       fprintf(stderr, "Could not parse move from player %d %s!\n",
@@ -381,17 +744,18 @@ GameResult RunGame(const char *command_player1, const char *command_player2,
       break;
     }
     std::string reason;
-    if (!ValidateMove(state, move, &reason)) {
+    if (!ValidateMove(position, move, &reason)) {
       fprintf(stderr, "Invalid move from player %d %s: (%s)!\n",
           next_player, EscapeString(line).c_str(), reason.c_str());
       break;
     }
-    ExecuteMove(state, move);
+    ExecuteMove(&position, move);
     history.push_back(move);
-    if (!IsGameOver(state)) {
+    if (!IsGameOver(position)) {
       // Send player's move to other player.
       std::string s = FormatMove(move);
       time_start = GetMonotonicTime();
+      cpu_start[1 - next_player] = GetCpuTime(players[1 - next_player]);
       if (!Write(players[1 - next_player], s + '\n')) {
         fprintf(stderr, "Could not send '%s' to player %d!\n", s.c_str(), next_player);
         break;
@@ -399,46 +763,311 @@ GameResult RunGame(const char *command_player1, const char *command_player2,
     }
   }
   int score = 0;
-  if (IsGameOver(state)) {
+  if (IsGameOver(position)) {
     // Regular game end.
-    score = CalculateScore(state);
+    score = Score(position);
   } else {
-    const int failing_player = GetNextPlayer(state);
+    const int failing_player = NextPlayer(position);
     if (failing_player == 0) {
       // White made an illegal move. Black wins.
-      score = -99;
+      score = -FAILURE_SCORE;
     } else if (failing_player == 1) {
       // Black made an illegal move. White wins.
-      score = +99;
+      score = +FAILURE_SCORE;
     } else {
       assert(false);
     }
   }
-  return {EncodeHistory(history), score, {time_used[0], time_used[1]}};
+  const bool reuse = IsGameOver(position);
+  ProcessUsage usage[2] = {
+    ReleasePlayer(players[0], command_player1, reuse),
+    ReleasePlayer(players[1], command_player2, reuse)};
+  return {EncodeHistory(history), score, {time_used[0], time_used[1]},
+      {usage[0].cpu_time, usage[1].cpu_time}, {usage[0].max_rss_kb, usage[1].max_rss_kb},
+      move_times, move_cpu_times, int(opening.size()), IsGameOver(position)};
 }
 
-// Maybe: support competition mode with random number of players?
-void Main(const char *player1_command, const char *player2_command, int rounds,
-    const char *logs_prefix) {
-  int wins[2] = {0, 0};
-  int ties[2] = {0, 0};
-  int losses[2] = {0, 0};
-  int failures[2] = {0, 0};
-  int score_by_color[2][2] = {{0, 0}, {0, 0}};
-  int score[2] = {0, 0};
-  double total_time[2] = {0.0, 0.0};
-  double max_time[2] = {0.0, 0.0};
+// Runs tasks 0 through num_tasks - 1 on `jobs` worker threads, and calls
+// `report` with the result of each task in order of task index, on the calling
+// thread, as soon as the results of all preceding tasks have been reported.
+// If `report` returns false, no further tasks are started, and the results of
+// tasks still running are discarded.
+template<class Result, class Task, class Report>
+void RunInOrder(int num_tasks, int jobs, Task task, Report report) {
+  std::vector<Result> results(num_tasks);
+  std::vector<bool> done(num_tasks, false);
+  std::mutex mutex;
+  std::condition_variable task_done;
+  int next_task = 0;
+  auto worker = [&]() {
+    for (;;) {
+      int i;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (next_task >= num_tasks) return;
+        i = next_task++;
+      }
+      Result result = task(i);
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        results[i] = std::move(result);
+        done[i] = true;
+      }
+      task_done.notify_one();
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int i = 0; i < std::max(1, std::min(jobs, num_tasks)); ++i) {
+    threads.emplace_back(worker);
+  }
+  for (int i = 0; i < num_tasks; ++i) {
+    std::unique_lock<std::mutex> lock(mutex);
+    task_done.wait(lock, [&]() { return bool(done[i]); });
+    Result result = std::move(results[i]);
+    lock.unlock();
+    if (!report(i, result)) {
+      std::lock_guard<std::mutex> stop_lock(mutex);
+      next_task = num_tasks;
+      break;
+    }
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+}
 
-  char filename_buf[2][1024];
+// Parameters of a sequential probability ratio test of the hypotheses that
+// player 1 is elo0 (H0) or elo1 (H1) Elo stronger than player 2, with error
+// probabilities alpha (of accepting H1 if H0 holds) and beta.
+struct SprtParameters {
+  double elo0, elo1, alpha, beta;
+};
 
-  const char *player_commands[2] = {player1_command, player2_command};
-  const char *program_names[2] = {"p1", "p2"};
-  const char *role_names[2] = {"white", "black"};
-  int games = rounds <= 0 ? 1 : 2*rounds;
-  for (int game = 0; game < games; ++game) {
-    int p = game & 1;
-    int q = 1 - p;
+// Expected score per game of a player that is `elo` Elo stronger.
+double EloToScore(double elo) {
+  return 1.0/(1.0 + pow(10.0, -elo/400.0));
+}
+
+double ScoreToElo(double score) {
+  score = std::min(std::max(score, 1e-6), 1.0 - 1e-6);
+  return -400.0*log10(1.0/score - 1.0);
+}
+
+// A sequential probability ratio test on the results of game pairs, in which
+// each player plays white once. The pair scores (0, 1/4, ..., 1 per game for
+// player 1) follow a pentanomial distribution, which captures the correlation
+// between the two games of a pair. As in the generalized SPRT, each hypothesis
+// is represented by the maximum likelihood distribution with its expected
+// score.
+class Sprt {
+public:
+  explicit Sprt(const SprtParameters &params)
+      : params(params),
+        lower_bound(log(params.beta/(1.0 - params.alpha))),
+        upper_bound(log((1.0 - params.beta)/params.alpha)) {}
+
+  // Adds a pair in which player 1 scored `points` (out of 2).
+  void AddPair(double points) {
+    counts[static_cast<int>(lround(points*2))] += 1;
+    pairs += 1;
+  }
+
+  int Pairs() const { return pairs; }
+
+  double Mean() const {
+    double sum = 0.0;
+    for (int i = 0; i < 5; ++i) sum += counts[i]*i/4.0;
+    return pairs > 0 ? sum/pairs : 0.5;
+  }
+
+  double Variance() const {
+    const double mean = Mean();
+    double sum = 0.0;
+    for (int i = 0; i < 5; ++i) sum += counts[i]*(i/4.0 - mean)*(i/4.0 - mean);
+    return pairs > 0 ? sum/pairs : 0.0;
+  }
+
+  double LogLikelihoodRatio() const {
+    const double lambda0 = Multiplier(EloToScore(params.elo0));
+    const double lambda1 = Multiplier(EloToScore(params.elo1));
+    double llr = 0.0;
+    for (int i = 0; i < 5; ++i) {
+      const double x = i/4.0;
+      llr += counts[i]*(log1p(lambda0*(x - EloToScore(params.elo0))) -
+                         log1p(lambda1*(x - EloToScore(params.elo1))));
+    }
+    return llr;
+  }
 
+  // Returns +1 if H1 is accepted, -1 if H0 is accepted, or 0 if the test
+  // hasn't reached a decision yet.
+  int Decision() const {
+    const double llr = LogLikelihoodRatio();
+    return llr >= upper_bound ? +1 : llr <= lower_bound ? -1 : 0;
+  }
+
+  // Prints the state of the test, with the Elo difference and the half-width
+  // of its 95% confidence interval.
+  void Print() const {
+    const double mean = Mean();
+    const double margin = 1.96*sqrt(Variance()/std::max(pairs, 1));
+    const double elo = ScoreToElo(mean);
+    const double error = (ScoreToElo(mean + margin) - ScoreToElo(mean - margin))/2;
+    printf("SPRT: pairs=%d pentanomial=[%d,%d,%d,%d,%d] llr=%.3f (%.3f, %.3f) elo=%+.1f +/- %.1f\n",
+        pairs, counts[0], counts[1], counts[2], counts[3], counts[4],
+        LogLikelihoodRatio(), lower_bound, upper_bound, elo, error);
+  }
+
+private:
+  // Returns the Lagrange multiplier of the maximum likelihood distribution
+  // with expected score `score`, which gives pair score i/4 the probability
+  // f[i]/(1 + lambda*(i/4 - score)), where f are the observed frequencies.
+  // They are regularized, so that results that didn't occur yet are possible.
+  double Multiplier(double score) const {
+    double f[5];
+    for (int i = 0; i < 5; ++i) f[i] = (counts[i] + 1e-3)/(pairs + 5e-3);
+    // The expected score decreases with lambda, which must keep all
+    // probabilities positive: -1/(1 - score) < lambda < 1/score.
+    double lo = -1.0/(1.0 - score);
+    double hi = 1.0/score;
+    for (int iteration = 0; iteration < 100; ++iteration) {
+      const double lambda = (lo + hi)/2;
+      double mean = 0.0;
+      for (int i = 0; i < 5; ++i) mean += f[i]*(i/4.0 - score)/(1 + lambda*(i/4.0 - score));
+      (mean > 0 ? lo : hi) = lambda;
+    }
+    return (lo + hi)/2;
+  }
+
+  const SprtParameters params;
+  const double lower_bound;
+  const double upper_bound;
+  int counts[5] = {0, 0, 0, 0, 0};  // pairs by player 1's points times 2
+  int pairs = 0;
+};
+
+// Maximum number of game pairs of an SPRT match, unless --rounds is given.
+const int SPRT_MAX_ROUNDS = 10000;
+
+// Estimates Elo ratings from the results of games between players, by maximum
+// likelihood in the Bradley-Terry model, where a tie counts as half a win. As
+// in BayesElo, players that met get a prior of one virtual tie, which keeps
+// the ratings finite. `points[i][j]` is the number of points that player i
+// scored in `games[i][j]` games against player j. The ratings average 0, and
+// `errors` are set to the half-widths of their 95% confidence intervals.
+void EstimateElo(const std::vector<std::vector<double>> &points,
+    const std::vector<std::vector<int>> &games,
+    std::vector<double> *elo, std::vector<double> *errors) {
+  const int n = points.size();
+  std::vector<std::vector<double>> w(n, std::vector<double>(n, 0.0));  // with the prior
+  std::vector<std::vector<double>> m(n, std::vector<double>(n, 0.0));
+  for (int i = 0; i < n; ++i) {
+    for (int j = 0; j < n; ++j) {
+      if (games[i][j] > 0) {
+        w[i][j] = points[i][j] + 0.5;
+        m[i][j] = games[i][j] + 1;
+      }
+    }
+  }
+  // Hunter's minorization-maximization iteration for the strengths gamma.
+  std::vector<double> gamma(n, 1.0);
+  for (int iteration = 0; iteration < 10000; ++iteration) {
+    double max_change = 0.0;
+    double log_sum = 0.0;
+    for (int i = 0; i < n; ++i) {
+      double wins = 0.0;
+      double denominator = 0.0;
+      for (int j = 0; j < n; ++j) {
+        wins += w[i][j];
+        denominator += m[i][j]/(gamma[i] + gamma[j]);
+      }
+      const double updated = denominator > 0 ? wins/denominator : 1.0;
+      max_change = std::max(max_change, fabs(log(updated/gamma[i])));
+      gamma[i] = updated;
+      log_sum += log(updated);
+    }
+    for (int i = 0; i < n; ++i) {
+      gamma[i] *= exp(-log_sum/n);
+    }
+    if (max_change < 1e-9) break;
+  }
+  const double elo_per_nat = 400.0/log(10.0);
+  elo->assign(n, 0.0);
+  errors->assign(n, 0.0);
+  for (int i = 0; i < n; ++i) {
+    double information = 0.0;
+    for (int j = 0; j < n; ++j) {
+      const double p = gamma[i]/(gamma[i] + gamma[j]);
+      information += m[i][j]*p*(1.0 - p);
+    }
+    (*elo)[i] = elo_per_nat*log(gamma[i]);
+    (*errors)[i] = information > 0 ? 1.96*elo_per_nat/sqrt(information) : INFINITY;
+  }
+}
+
+// Plays a match between two players, or a tournament between more: a
+// round-robin, or with `gauntlet`, the first player against each of the
+// others. Each pairing plays `rounds` rounds of two games with colors swapped,
+// and the games of all pairings are shared by the `jobs` worker threads.
+void Main(const std::vector<const char*> &player_commands, bool gauntlet, int rounds,
+    const char *logs_prefix, int jobs, const TimeControl &time_control,
+    const SprtParameters *sprt_params, const std::vector<std::vector<Move>> &openings,
+    const char *dataset_path) {
+  const int num_players = player_commands.size();
+  DatasetWriter dataset;
+  if (dataset_path != nullptr && !dataset.Open(dataset_path)) {
+    perror(dataset_path);
+    exit(1);
+  }
+  std::vector<int> wins(num_players, 0);
+  std::vector<int> ties(num_players, 0);
+  std::vector<int> losses(num_players, 0);
+  std::vector<int> failures(num_players, 0);
+  std::vector<std::vector<int>> score_by_color(num_players, std::vector<int>(2, 0));
+  std::vector<int> score(num_players, 0);
+  std::vector<int> games_by_player(num_players, 0);
+  std::vector<double> total_time(num_players, 0.0);
+  std::vector<double> max_time(num_players, 0.0);
+  std::vector<double> max_move_time(num_players, 0.0);
+  std::vector<double> max_move_cpu_time(num_players, 0.0);
+  std::vector<double> total_cpu_time(num_players, 0.0);
+  std::vector<long> max_rss_kb(num_players, 0);
+  // By pair of players, from the first player's perspective.
+  std::vector<std::vector<int>> pair_wins(num_players, std::vector<int>(num_players, 0));
+  std::vector<std::vector<int>> pair_ties(num_players, std::vector<int>(num_players, 0));
+  std::vector<std::vector<int>> pair_games(num_players, std::vector<int>(num_players, 0));
+  std::vector<std::vector<double>> pair_points(num_players, std::vector<double>(num_players, 0.0));
+
+  std::vector<std::string> program_names;
+  for (int i = 0; i < num_players; ++i) {
+    program_names.push_back("p" + std::to_string(i + 1));
+  }
+  const char *role_names[2] = {"white", "black"};
+  std::vector<std::pair<int, int>> pairings;
+  for (int i = 0; i < num_players; ++i) {
+    for (int j = i + 1; j < num_players; ++j) {
+      if (!gauntlet || i == 0) pairings.emplace_back(i, j);
+    }
+  }
+  const int num_pairings = pairings.size();
+  if (sprt_params != nullptr && rounds <= 0) rounds = SPRT_MAX_ROUNDS;
+  if (!openings.empty() && rounds <= 0) rounds = openings.size();
+  if (num_pairings > 1 && rounds <= 0) rounds = 1;
+  int games = rounds <= 0 ? 1 : 2*rounds*num_pairings;
+  int games_played = 0;
+  std::unique_ptr<Sprt> sprt(sprt_params ? new Sprt(*sprt_params) : nullptr);
+  double sprt_pair_points = 0.0;  // player 1's points in the current pair
+  // Games are ordered by round, then by pairing, then by color: game 2k of a
+  // round has the pairing's first player as white, game 2k + 1 the other.
+  auto game_players = [&](int game, int *p, int *q) {
+    const std::pair<int, int> &pairing = pairings[game/2 % num_pairings];
+    *p = game & 1 ? pairing.second : pairing.first;
+    *q = game & 1 ? pairing.first : pairing.second;
+  };
+  auto play_game = [&](int game) {
+    int p, q;
+    game_players(game, &p, &q);
+    char filename_buf[2][1024];
     if (logs_prefix == nullptr) {
       snprintf(filename_buf[0], sizeof(filename_buf[0]), "/dev/null");
       snprintf(filename_buf[1], sizeof(filename_buf[1]), "/dev/null");
@@ -447,14 +1076,29 @@ void Main(const char *player1_command, const char *player2_command, int rounds,
       snprintf(filename_buf[1], sizeof(filename_buf[1]), "/dev/stderr");
     } else {
       snprintf(filename_buf[0], sizeof(filename_buf[0]), "%s%04d_%s_%s",
-          logs_prefix, game, program_names[p], role_names[0]);
+          logs_prefix, game, program_names[p].c_str(), role_names[0]);
       snprintf(filename_buf[1], sizeof(filename_buf[1]), "%s%04d_%s_%s",
-          logs_prefix, game, program_names[q], role_names[1]);
+          logs_prefix, game, program_names[q].c_str(), role_names[1]);
     }
-    GameResult result = RunGame(player_commands[p], player_commands[q],
-        filename_buf[0], filename_buf[1]);
-    printf("%4d: %s %s%d\n", game, result.transcript.c_str(),
-        (result.score > 0 ? "+" : ""), result.score);
+    // All games of a round play the same opening, with colors swapped.
+    static const std::vector<Move> no_opening;
+    const int round = game/(2*num_pairings);
+    const std::vector<Move> &opening =
+        openings.empty() ? no_opening : openings[round % openings.size()];
+    return RunGame(player_commands[p], player_commands[q],
+        filename_buf[0], filename_buf[1], time_control, opening);
+  };
+  auto report_game = [&](int game, const GameResult &result) {
+    int p, q;
+    game_players(game, &p, &q);
+    if (num_players > 2) {
+      printf("%4d: %s-%s %s %s%d\n", game, program_names[p].c_str(), program_names[q].c_str(),
+          result.transcript.c_str(), (result.score > 0 ? "+" : ""), result.score);
+    } else {
+      printf("%4d: %s %s%d\n", game, result.transcript.c_str(),
+          (result.score > 0 ? "+" : ""), result.score);
+    }
+    fflush(stdout);
     score[p] += result.score;
     score[q] -= result.score;
     score_by_color[p][0] += result.score;
@@ -465,35 +1109,127 @@ void Main(const char *player1_command, const char *player2_command, int rounds,
     ties[q] += result.score == 0;
     losses[p] += result.score < 0;
     losses[q] += result.score > 0;
-    failures[p] += result.score == -99;
-    failures[q] += result.score == +99;
+    failures[p] += result.score == -FAILURE_SCORE;
+    failures[q] += result.score == +FAILURE_SCORE;
+    games_by_player[p] += 1;
+    games_by_player[q] += 1;
     total_time[p] += result.walltime_used[0];
     total_time[q] += result.walltime_used[1];
     max_time[p] = std::max(max_time[p], result.walltime_used[0]);
     max_time[q] = std::max(max_time[q], result.walltime_used[1]);
+    total_cpu_time[p] += result.cputime_used[0];
+    total_cpu_time[q] += result.cputime_used[1];
+    max_rss_kb[p] = std::max(max_rss_kb[p], result.max_rss_kb[0]);
+    max_rss_kb[q] = std::max(max_rss_kb[q], result.max_rss_kb[1]);
+    for (size_t i = 0; i < result.move_times.size(); ++i) {
+      int player = ((result.opening_length + i) & 1) ? q : p;
+      max_move_time[player] = std::max(max_move_time[player], result.move_times[i]);
+      max_move_cpu_time[player] = std::max(max_move_cpu_time[player], result.move_cpu_times[i]);
+    }
+    const double white_points = result.score > 0 ? 1.0 : result.score == 0 ? 0.5 : 0.0;
+    pair_wins[p][q] += result.score > 0;
+    pair_wins[q][p] += result.score < 0;
+    pair_ties[p][q] += result.score == 0;
+    pair_ties[q][p] += result.score == 0;
+    pair_games[p][q] += 1;
+    pair_games[q][p] += 1;
+    pair_points[p][q] += white_points;
+    pair_points[q][p] += 1.0 - white_points;
+    if (dataset_path != nullptr && result.completed) {
+      dataset.AddGame(DecodeHistory(result.transcript));
+    }
+    games_played += 1;
+    if (sprt == nullptr) return true;
+    sprt_pair_points += p == 0 ? white_points : 1.0 - white_points;
+    if (p == 0) return true;
+    sprt->AddPair(sprt_pair_points);
+    sprt_pair_points = 0.0;
+    sprt->Print();
+    fflush(stdout);
+    return sprt->Decision() == 0;
+  };
+  RunInOrder<GameResult>(games, jobs, play_game, report_game);
+  QuitIdlePlayers();
+  if (!dataset.Close()) {
+    fprintf(stderr, "Could not write dataset %s!\n", dataset_path);
+  }
+  if (sprt != nullptr) {
+    const int decision = sprt->Decision();
+    printf("SPRT: %s after %d games\n",
+        decision > 0 ? "H1 accepted" : decision < 0 ? "H0 accepted" : "no decision",
+        games_played);
   }
-  if (games > 1) {
+  if (games_played > 1) {
     printf("\n");
-    printf("Player               AvgTm MaxTm Wins Ties Loss Fail RedPts BluePt Total\n");
-    printf("-------------------- ----- ----- ---- ---- ---- ---- ------ ------ ------\n");
-    for (int i = 0; i < 2; ++i) {
+    printf("Player               AvgTm MaxTm MaxMv AvgCp MaxMC MaxMB Wins Ties Loss Fail RedPts BluePt Total\n");
+    printf("-------------------- ----- ----- ----- ----- ----- ----- ---- ---- ---- ---- ------ ------ ------\n");
+    for (int i = 0; i < num_players; ++i) {
       const char *command = player_commands[i];
       while (strlen(command) > 20 && strchr(command, '/')) {
         command = strchr(command, '/') + 1;
       }
-      printf("%-20s %.3f %.3f %4d %4d %4d %4d %+6d %+6d %+6d\n",
-          command, total_time[i]/games, max_time[i],
+      const int n = std::max(games_by_player[i], 1);
+      printf("%-20s %.3f %.3f %.3f %.3f %.3f %5.1f %4d %4d %4d %4d %+6d %+6d %+6d\n",
+          command, total_time[i]/n, max_time[i], max_move_time[i],
+          total_cpu_time[i]/n, max_move_cpu_time[i], max_rss_kb[i]/1024.0,
           wins[i], ties[i], losses[i], failures[i],
           score_by_color[i][0], score_by_color[i][1], score[i]);
     }
   }
+  if (num_players > 2 && games_played > 0) {
+    printf("\nWins-ties-losses of each player (row) against each opponent (column):\n");
+    printf("    ");
+    for (int j = 0; j < num_players; ++j) {
+      printf(" %11s", program_names[j].c_str());
+    }
+    printf("\n");
+    for (int i = 0; i < num_players; ++i) {
+      printf("%-4s", program_names[i].c_str());
+      for (int j = 0; j < num_players; ++j) {
+        if (pair_games[i][j] == 0) {
+          printf(" %11s", "-");
+          continue;
+        }
+        char cell[32];
+        snprintf(cell, sizeof(cell), "%d-%d-%d", pair_wins[i][j], pair_ties[i][j],
+            pair_games[i][j] - pair_wins[i][j] - pair_ties[i][j]);
+        printf(" %11s", cell);
+      }
+      printf("\n");
+    }
+    std::vector<double> elo, errors;
+    EstimateElo(pair_points, pair_games, &elo, &errors);
+    std::vector<int> ranking;
+    for (int i = 0; i < num_players; ++i) {
+      ranking.push_back(i);
+    }
+    std::stable_sort(ranking.begin(), ranking.end(),
+        [&](int a, int b) { return elo[a] > elo[b]; });
+    printf("\nRank Player  Elo    +/-  Games Points  Command\n");
+    for (int r = 0; r < num_players; ++r) {
+      const int i = ranking[r];
+      double points = 0.0;
+      for (int j = 0; j < num_players; ++j) {
+        points += pair_points[i][j];
+      }
+      printf("%4d %-6s %+5.0f %6.0f %6d %6.1f  %s\n", r + 1, program_names[i].c_str(),
+          elo[i], errors[i], games_by_player[i], points, player_commands[i]);
+    }
+  }
 }
 
 }  // namespace
 
 int main(int argc, char *argv[]) {
   int opt_rounds = 0;
+  int opt_jobs = 1;
+  TimeControl opt_time_control;
   const char *opt_logs_prefix = nullptr;
+  SprtParameters sprt_params;
+  const SprtParameters *opt_sprt = nullptr;
+  std::vector<std::vector<Move>> opt_openings;
+  bool opt_gauntlet = false;
+  const char *opt_dataset = nullptr;
   // Parse option arguments.
   int j = 1;
   for (int i = 1; i < argc; ++i) {
@@ -505,6 +1241,22 @@ int main(int argc, char *argv[]) {
     int value = 0;
     if (sscanf(argv[i], "--rounds=%d", &value) == 1) {
       opt_rounds = value;
+    } else if (sscanf(argv[i], "--jobs=%d", &value) == 1 && value > 0) {
+      opt_jobs = value;
+    } else if (sscanf(argv[i], "--time=%lf", &opt_time_control.game_time) == 1) {
+    } else if (sscanf(argv[i], "--move-time=%lf", &opt_time_control.move_time) == 1) {
+    } else if (sscanf(argv[i], "--sprt=%lf,%lf,%lf,%lf", &sprt_params.elo0, &sprt_params.elo1,
+                   &sprt_params.alpha, &sprt_params.beta) == 4 &&
+               sprt_params.elo0 < sprt_params.elo1 &&
+               sprt_params.alpha > 0 && sprt_params.alpha < 1 &&
+               sprt_params.beta > 0 && sprt_params.beta < 1) {
+      opt_sprt = &sprt_params;
+    } else if (strncmp(argv[i], "--dataset=", strlen("--dataset=")) == 0) {
+      opt_dataset = arg + strlen("--dataset=");
+    } else if (strcmp(argv[i], "--gauntlet") == 0) {
+      opt_gauntlet = true;
+    } else if (strncmp(argv[i], "--openings=", strlen("--openings=")) == 0) {
+      opt_openings = ReadOpenings(arg + strlen("--openings="));
     } else if (strncmp(argv[i], "--logs=", strlen("--logs=")) == 0) {
       opt_logs_prefix = arg + strlen("--logs=");
     } else {
@@ -512,10 +1264,33 @@ int main(int argc, char *argv[]) {
     }
   }
   argc = j;
-  if (argc != 3) {
-    printf("Usage: arbiter [--rounds=<N>] [--logs=<filename-prefix>] <player1> <player2>\n");
+  if (argc < 3 || (opt_sprt != nullptr && argc != 3)) {
+    printf("Usage: arbiter [--rounds=<N>] [--jobs=<N>] [--logs=<filename-prefix>] "
+        "[--time=<seconds per game>] [--move-time=<seconds per move>] "
+        "[--sprt=<elo0>,<elo1>,<alpha>,<beta>] [--openings=<filename>] [--gauntlet] "
+        "[--dataset=<filename>] "
+        "<player1> <player2> [<player3> ...]\n"
+        "A player whose program ends in .so is loaded as a plugin (see flippo_plugin.h).\n"
+        "With more than two players, each pair of players plays --rounds rounds (a\n"
+        "round-robin), or with --gauntlet, player 1 plays each of the others. The\n"
+        "results are summarized in a matrix and as Elo ratings.\n"
+        "With --sprt, the match stops as soon as the test accepts either hypothesis\n"
+        "(player 1 is elo0 or elo1 Elo stronger), after at most --rounds game pairs.\n"
+        "It requires exactly two players.\n"
+        "With --openings, each round starts from the next opening in the file (one\n"
+        "transcript per line), with colors swapped between its two games. By default,\n"
+        "every opening is played once.\n"
+        "With --dataset, every position of each completed game is appended to the file\n"
+        "in the binary format of flippo_dataset.h.\n");
     return 1;
   }
-  Main(argv[1], argv[2], opt_rounds, opt_logs_prefix);
+  // Ignore SIGPIPE, so writing to a player that has exited fails with EPIPE
+  // instead of killing the arbiter. See Write().
+  signal(SIGPIPE, SIG_IGN);
+  // Set before any threads start, and inherited by all player processes.
+  setenv("FLIPPO_ARBITER_FEATURES", ARBITER_FEATURES, 1);
+  const std::vector<const char*> player_commands(argv + 1, argv + argc);
+  Main(player_commands, opt_gauntlet, opt_rounds, opt_logs_prefix, opt_jobs, opt_time_control,
+      opt_sprt, opt_openings, opt_dataset);
   return 0;
 }
@@ -0,0 +1,168 @@
+// Measures the speed of the player's move generation, evaluation and search,
+// and checks move generation with perft node counts. Each result is printed
+// as a line of key=value pairs.
+
+#define FLIPPO_NO_MAIN
+#include "player.cc"
+
+namespace {
+
+// Perft node counts from the initial position, by depth. Computed with the
+// arbiter's original (non-bitboard) move generation.
+const long long PERFT_NODES[] = {
+    1, 6, 32, 212, 1728, 15668, 162108, 1864284, 23343080, 317470312,
+};
+const int PERFT_KNOWN_DEPTH = sizeof(PERFT_NODES)/sizeof(PERFT_NODES[0]) - 1;
+
+const int NUM_POSITIONS = 64;
+
+long long Perft(Board *board, int depth) {
+    if (depth == 0) return 1;
+    if (depth == 1) return __builtin_popcountll(ValidMoves(*board));
+    Move moves[MAX_MOVES];
+    const int num_moves = ListMoves(*board, &moves);
+    long long nodes = 0;
+    REP(i, num_moves) {
+        DoMove(board, moves[i]);
+        nodes += Perft(board, depth - 1);
+        UndoMove(board, moves[i]);
+    }
+    return nodes;
+}
+
+// Returns positions from all phases of the game, reached by random moves
+// from a fixed seed so they are the same on every run.
+std::vector<Board> BenchPositions() {
+    std::vector<Board> positions;
+    uint64_t x = 0x2545f4914f6cdd1dull;
+    REP(i, NUM_POSITIONS) {
+        Board board = InitialBoard();
+        const int num_moves = 4 + i*(MAX_MOVES - 8)/NUM_POSITIONS;
+        REP(j, num_moves) {
+            Move moves[MAX_MOVES];
+            const int n = ListMoves(board, &moves);
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            DoMove(&board, moves[x % n]);
+        }
+        positions.push_back(board);
+    }
+    return positions;
+}
+
+// Prevents the compiler from optimizing away benchmarked computations.
+volatile long long bench_sink;
+
+void ReportOps(const char *name, long long ops, double time) {
+    printf("bench=%s ops=%lld time=%.6f ns_per_op=%.2f\n", name, ops, time, time*1e9/ops);
+}
+
+void BenchListMoves(const std::vector<Board> &positions, int reps) {
+    long long ops = 0, sum = 0;
+    const double start = GetTime();
+    REP(r, reps) {
+        for (const Board &board : positions) {
+            Move moves[MAX_MOVES];
+            sum += ListMoves(board, &moves);
+            ++ops;
+        }
+    }
+    ReportOps("ListMoves", ops, GetTime() - start);
+    bench_sink = sum;
+}
+
+void BenchDoUndoMove(std::vector<Board> positions, int reps) {
+    long long ops = 0, sum = 0;
+    const double start = GetTime();
+    REP(r, reps) {
+        for (Board &board : positions) {
+            Move moves[MAX_MOVES];
+            const int num_moves = ListMoves(board, &moves);
+            REP(i, num_moves) {
+                DoMove(&board, moves[i]);
+                sum += board.hash;
+                UndoMove(&board, moves[i]);
+            }
+            ops += num_moves;
+        }
+    }
+    ReportOps("DoMoveUndoMove", ops, GetTime() - start);
+    bench_sink = sum;
+}
+
+void BenchEvaluate(const std::vector<Board> &positions, int reps) {
+    long long ops = 0, sum = 0;
+    const double start = GetTime();
+    REP(r, reps) {
+        for (const Board &board : positions) {
+            sum += Evaluate(board);
+            ++ops;
+        }
+    }
+    ReportOps("Evaluate", ops, GetTime() - start);
+    bench_sink = sum;
+}
+
+// Searches each position to a fixed depth, with a fresh transposition table,
+// so the node count only changes when the search does.
+void BenchSearch(std::vector<Board> positions, int depth) {
+    transpositions.Clear();
+    search_stack = &search_stacks[0];
+    long long nodes = 0, sum = 0;
+    double time = 0;
+    for (Board &board : positions) {
+        PrepareSearch(1e9);
+        PrepareSolve(board);
+        search_nodes = 0;
+        const double start = GetTime();
+        sum += Search(&board, depth, MIN_VALUE - 1, MAX_VALUE + 1);
+        time += GetTime() - start;
+        nodes += search_nodes;
+    }
+    printf("bench=Search depth=%d positions=%d nodes=%lld value_sum=%lld time=%.6f nps=%.0f\n",
+        depth, int(positions.size()), nodes, sum, time, time > 0 ? nodes/time : 0.0);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    Options options;
+    int perft_depth = 8;
+    int search_depth = 6;
+    int reps = 1000;
+    for (int i = 1; i < argc; ++i) {
+        if (sscanf(argv[i], "--perft=%d", &perft_depth) == 1 && perft_depth >= 0) continue;
+        if (sscanf(argv[i], "--depth=%d", &search_depth) == 1 && search_depth > 0) continue;
+        if (sscanf(argv[i], "--reps=%d", &reps) == 1 && reps > 0) continue;
+        if (strncmp(argv[i], "--simd=", 7) == 0 && SelectMoveGeneration(argv[i] + 7)) continue;
+        if (ParseOption(argv[i], &options)) continue;
+        std::cerr << "Unrecognized argument: [" << argv[i] << "]\n"
+            << "Usage: bench [--perft=<depth>] [--depth=<search depth>] [--reps=<N>] "
+            << "[--simd=avx2|sse2|scalar] [player options]\n";
+        return 1;
+    }
+    if (!AllocateSearchMemory(options)) return 1;
+    if (!options.weights_path.empty() && !LoadWeights(options.weights_path.c_str())) return 1;
+    printf("bench=config move_generation=%s evaluation=%s\n", ActiveMoveGeneration().name,
+        pattern_weights ? "patterns" : "default");
+    bool ok = true;
+    FOR(depth, 1, perft_depth + 1) {
+        Board board = InitialBoard();
+        const double start = GetTime();
+        const long long nodes = Perft(&board, depth);
+        const double time = GetTime() - start;
+        printf("bench=perft depth=%d nodes=%lld time=%.6f nps=%.0f\n",
+            depth, nodes, time, time > 0 ? nodes/time : 0.0);
+        if (depth <= PERFT_KNOWN_DEPTH && nodes != PERFT_NODES[depth]) {
+            std::cerr << "perft(" << depth << ") should be " << PERFT_NODES[depth] << "!\n";
+            ok = false;
+        }
+    }
+    const std::vector<Board> positions = BenchPositions();
+    BenchListMoves(positions, reps);
+    BenchDoUndoMove(positions, reps);
+    BenchEvaluate(positions, reps);
+    BenchSearch(positions, search_depth);
+    return ok ? 0 : 1;
+}
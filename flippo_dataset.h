@@ -0,0 +1,201 @@
+// A compact binary format for positions from played games, for fitting the
+// evaluation offline. The arbiter writes it (see --dataset), and tools read it
+// memory-mapped. Programs that include this header must link with -lz.
+//
+// A dataset file is a sequence of blocks, and is only ever appended to. Each
+// block is a DatasetBlockHeader followed by `num_records` DatasetRecord
+// structs (in native byte order), compressed with zlib, with at most
+// DatasetWriter::BLOCK_RECORDS records per block. A block is written
+// with a single write(), and a reader ignores an incomplete block at the end
+// of the file, so a file stays readable if a writer is interrupted.
+
+#ifndef FLIPPO_DATASET_H
+#define FLIPPO_DATASET_H
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <vector>
+
+#include "flippo_rules.h"
+
+namespace flippo {
+
+const int16_t DATASET_NO_VALUE = INT16_MIN;
+const uint8_t DATASET_NO_MOVE = 255;
+
+struct DatasetRecord {
+    Bitboard pieces[2];    // indexed by player: white, black
+    uint8_t moves_played;  // the player to move is moves_played % 2
+    uint8_t move;          // field of the move played next, or DATASET_NO_MOVE
+    int8_t score;          // final Score() of the game
+    uint8_t unused;
+    int16_t value;         // search value for the player to move, or DATASET_NO_VALUE
+    uint16_t unused2;
+};
+
+const char DATASET_BLOCK_MAGIC[4] = {'F', 'D', 'B', '1'};
+
+struct DatasetBlockHeader {
+    char magic[4];
+    uint32_t record_size;      // sizeof(DatasetRecord)
+    uint32_t num_records;
+    uint32_t compressed_size;  // bytes of zlib data that follow the header
+};
+
+static_assert(sizeof(DatasetRecord) == 24 && sizeof(DatasetBlockHeader) == 16,
+    "dataset format changed");
+
+// Appends records to a dataset file, compressing them in blocks of
+// BLOCK_RECORDS records.
+class DatasetWriter {
+public:
+    static const size_t BLOCK_RECORDS = 1 << 14;
+
+    ~DatasetWriter() { Close(); }
+
+    bool Open(const char *path) {
+        fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+        return fd >= 0;
+    }
+
+    // Writes the buffered records and closes the file. Returns false if
+    // writing failed at any point.
+    bool Close() {
+        if (fd < 0) return ok;
+        Flush();
+        ok = close(fd) == 0 && ok;
+        fd = -1;
+        return ok;
+    }
+
+    void Add(const DatasetRecord &record) {
+        records.push_back(record);
+        if (records.size() >= BLOCK_RECORDS) Flush();
+    }
+
+    // Adds every position of a complete game, given its moves.
+    void AddGame(const std::vector<Move> &moves) {
+        Position position = InitialPosition();
+        for (const Move &move : moves) ExecuteMove(&position, move);
+        const int score = Score(position);
+        position = InitialPosition();
+        for (size_t i = 0; i <= moves.size(); ++i) {
+            DatasetRecord record = {};
+            record.pieces[0] = position.pieces[0];
+            record.pieces[1] = position.pieces[1];
+            record.moves_played = position.moves_played;
+            record.move = i < moves.size() ? FieldIndex(moves[i]) : DATASET_NO_MOVE;
+            record.score = score;
+            record.value = DATASET_NO_VALUE;
+            Add(record);
+            if (i < moves.size()) ExecuteMove(&position, moves[i]);
+        }
+    }
+
+    // Writes the buffered records as a block.
+    void Flush() {
+        if (records.empty() || fd < 0) return;
+        const uLong size = records.size()*sizeof(DatasetRecord);
+        uLongf compressed_size = compressBound(size);
+        std::vector<char> block(sizeof(DatasetBlockHeader) + compressed_size);
+        if (compress(reinterpret_cast<Bytef*>(&block[sizeof(DatasetBlockHeader)]), &compressed_size,
+                reinterpret_cast<const Bytef*>(records.data()), size) != Z_OK) {
+            ok = false;
+            return;
+        }
+        DatasetBlockHeader header;
+        memcpy(header.magic, DATASET_BLOCK_MAGIC, sizeof(header.magic));
+        header.record_size = sizeof(DatasetRecord);
+        header.num_records = records.size();
+        header.compressed_size = compressed_size;
+        memcpy(&block[0], &header, sizeof(header));
+        block.resize(sizeof(header) + compressed_size);
+        ok = write(fd, block.data(), block.size()) == ssize_t(block.size()) && ok;
+        records.clear();
+    }
+
+private:
+    int fd = -1;
+    bool ok = true;
+    std::vector<DatasetRecord> records;
+};
+
+// Reads a memory-mapped dataset file block by block.
+class DatasetReader {
+public:
+    ~DatasetReader() {
+        if (data) munmap(data, size);
+    }
+
+    bool Open(const char *path) {
+        const int fd = open(path, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        size = st.st_size;
+        void *map = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : nullptr;
+        close(fd);
+        if (map == MAP_FAILED) return false;
+        data = map;
+        if (data) madvise(data, size, MADV_SEQUENTIAL);
+        return true;
+    }
+
+    // Decompresses the next block into `records`. Returns false at the end of
+    // the file, or at a block that is incomplete or invalid (see Error()).
+    bool NextBlock(std::vector<DatasetRecord> *records) {
+        const char *p = static_cast<const char*>(data) + offset;
+        DatasetBlockHeader header;
+        if (size - offset < sizeof(header)) {
+            if (size > offset) error = "incomplete block";
+            return false;
+        }
+        memcpy(&header, p, sizeof(header));
+        if (memcmp(header.magic, DATASET_BLOCK_MAGIC, sizeof(header.magic)) != 0 ||
+                header.record_size != sizeof(DatasetRecord) || header.num_records == 0 ||
+                header.num_records > DatasetWriter::BLOCK_RECORDS) {
+            error = "invalid block header";
+            return false;
+        }
+        if (size - offset - sizeof(header) < header.compressed_size) {
+            error = "incomplete block";
+            return false;
+        }
+        records->resize(header.num_records);
+        uLongf uncompressed_size = header.num_records*sizeof(DatasetRecord);
+        if (uncompress(reinterpret_cast<Bytef*>(records->data()), &uncompressed_size,
+                reinterpret_cast<const Bytef*>(p + sizeof(header)), header.compressed_size) != Z_OK ||
+                uncompressed_size != header.num_records*sizeof(DatasetRecord)) {
+            records->clear();
+            error = "invalid block data";
+            return false;
+        }
+        offset += sizeof(header) + header.compressed_size;
+        return true;
+    }
+
+    // Returns the number of bytes after the blocks read so far.
+    size_t Remaining() const { return size - offset; }
+
+    // Returns why NextBlock() stopped before the end of the file, or nullptr
+    // if it didn't. An incomplete block is what an interrupted writer leaves.
+    const char *Error() const { return error; }
+
+private:
+    void *data = nullptr;
+    size_t size = 0;
+    size_t offset = 0;
+    const char *error = nullptr;
+};
+
+}  // namespace flippo
+
+#endif  // FLIPPO_DATASET_H
@@ -0,0 +1,51 @@
+// C interface for players that the arbiter loads into its own process, which
+// avoids the cost of running a process per player and passing moves through
+// pipes. player.cc builds as a plugin with -DFLIPPO_PLUGIN (see the Makefile).
+//
+// The arbiter loads a separate copy of the library for each player in each
+// game that it runs concurrently, so a plugin may keep its state in globals.
+// A copy plays one game at a time, but is reused for later games.
+//
+// Fields are given as row and column numbers counting from 0, so row 0 and
+// column 0 correspond to move "A1" in the text protocol.
+
+#ifndef FLIPPO_PLUGIN_H
+#define FLIPPO_PLUGIN_H
+
+#define FLIPPO_PLUGIN_VERSION 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Returns FLIPPO_PLUGIN_VERSION.
+int flippo_plugin_version(void);
+
+// Starts a new game, with space-separated arguments as on the player's
+// command line. Diagnostic output goes to the file `log_filename`. Returns
+// null if the arguments are invalid.
+void *flippo_new_game(const char *args, const char *log_filename);
+
+// Plays the opponent's move. Returns 0 if the move is invalid. The arbiter
+// also plays the moves of an opening for both sides with this function.
+int flippo_opponent_move(void *game, int row, int col);
+
+// Selects and plays a move for the player to move, which is the plugin's side:
+// white if this is called before flippo_opponent_move(). Returns 0 if there is
+// no move.
+int flippo_select_move(void *game, int *row, int *col);
+
+// Ends the game and frees the instance.
+void flippo_free_game(void *game);
+
+typedef int flippo_plugin_version_fn(void);
+typedef void *flippo_new_game_fn(const char *args, const char *log_filename);
+typedef int flippo_opponent_move_fn(void *game, int row, int col);
+typedef int flippo_select_move_fn(void *game, int *row, int *col);
+typedef void flippo_free_game_fn(void *game);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // FLIPPO_PLUGIN_H
@@ -0,0 +1,570 @@
+// The rules of Flippo on bitboards, shared by the arbiter and the player.
+//
+// Fields are numbered r*W + c for row r and column c; move "A1" is row 0,
+// column 0. Player 0 is white, who moves first; player 1 is black.
+
+#ifndef FLIPPO_RULES_H
+#define FLIPPO_RULES_H
+
+#include <stdint.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <string>
+
+#define FLIPPO_ALWAYS_INLINE inline __attribute__((always_inline))
+
+namespace flippo {
+
+const int H = 8;
+const int W = 8;
+const int MAX_MOVES = H*W - 4;  // every game fills the board
+
+static_assert(H*W <= 64, "board must fit in a 64-bit word");
+static_assert(H <= 26 && W <= 9, "moves must be formatted as a letter and a digit");
+
+// Set of fields, where bit (r*W + c) represents the field at row r, column c.
+typedef uint64_t Bitboard;
+
+struct Move {
+    Move() : row(0), col(0) {}
+    constexpr Move(int row, int col) : row(row), col(col) {}
+
+    short row, col;
+};
+
+constexpr bool ValidCoords(int r, int c) {
+    return r >= 0 && r < H && c >= 0 && c < W;
+}
+
+constexpr Bitboard Bit(int r, int c) {
+    return Bitboard(1) << (r*W + c);
+}
+
+inline int FieldIndex(const Move &move) {
+    return move.row*W + move.col;
+}
+
+inline Move FieldMove(int i) {
+    return Move(i / W, i % W);
+}
+
+inline Bitboard Bit(const Move &move) {
+    return Bitboard(1) << FieldIndex(move);
+}
+
+constexpr Bitboard ColumnMask(int c, int r = 0) {
+    return r < H ? Bit(r, c) | ColumnMask(c, r + 1) : 0;
+}
+
+const Bitboard ALL_FIELDS = H*W == 64 ? ~Bitboard(0) : (Bitboard(1) << (H*W)) - 1;
+
+// The 8 directions, as row and column deltas. Directions d and 7 - d are
+// opposites.
+constexpr int DR[8] = { -1, -1, -1,  0,  0, +1, +1, +1 };
+constexpr int DC[8] = { -1,  0, +1, -1, +1, -1,  0, +1 };
+
+constexpr int ShiftAmount(int d) {
+    return DR[d]*W + DC[d];
+}
+
+// Fields that can be reached by a single step in direction d. Used to discard
+// bits that wrap around from one side of the board to the other.
+constexpr Bitboard DirectionMask(int d) {
+    return DC[d] > 0 ? ALL_FIELDS & ~ColumnMask(0) :
+           DC[d] < 0 ? ALL_FIELDS & ~ColumnMask(W - 1) : ALL_FIELDS;
+}
+
+template<int... I> struct Indices {};
+template<int N, int... I> struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+template<int... I> struct MakeIndices<0, I...> { typedef Indices<I...> Type; };
+
+template<int N> struct MaskTable { Bitboard masks[N]; };
+
+// Compile-time tables of masks per field, for a board of h rows and w columns.
+template<int h, int w>
+struct Geometry {
+    static constexpr bool Valid(int r, int c) {
+        return r >= 0 && r < h && c >= 0 && c < w;
+    }
+
+    static constexpr Bitboard FieldBit(int r, int c) {
+        return Valid(r, c) ? Bitboard(1) << (r*w + c) : 0;
+    }
+
+    // Fields reached from (r, c) by one or more steps in direction d.
+    static constexpr Bitboard Ray(int d, int r, int c) {
+        return Valid(r + DR[d], c + DC[d]) ?
+            FieldBit(r + DR[d], c + DC[d]) | Ray(d, r + DR[d], c + DC[d]) : 0;
+    }
+
+    // Fields adjacent to (r, c), from direction d on.
+    static constexpr Bitboard Neighborhood(int r, int c, int d = 0) {
+        return d < 8 ? FieldBit(r + DR[d], c + DC[d]) | Neighborhood(r, c, d + 1) : 0;
+    }
+
+    template<int... I>
+    static constexpr MaskTable<sizeof...(I)> MakeRays(Indices<I...>) {
+        return {{ Ray(I / (h*w), I % (h*w) / w, I % w)... }};
+    }
+
+    template<int... I>
+    static constexpr MaskTable<sizeof...(I)> MakeNeighbors(Indices<I...>) {
+        return {{ Neighborhood(I / w, I % w)... }};
+    }
+
+    // Indexed by d*h*w + field.
+    static constexpr MaskTable<8*h*w> RAYS = MakeRays(typename MakeIndices<8*h*w>::Type());
+    // Indexed by field.
+    static constexpr MaskTable<h*w> NEIGHBORS = MakeNeighbors(typename MakeIndices<h*w>::Type());
+};
+
+template<int h, int w> constexpr MaskTable<8*h*w> Geometry<h, w>::RAYS;
+template<int h, int w> constexpr MaskTable<h*w> Geometry<h, w>::NEIGHBORS;
+
+// Fields reached from `field` by one or more steps in direction d.
+inline Bitboard RayMask(int d, int field) {
+    return Geometry<H, W>::RAYS.masks[d*H*W + field];
+}
+
+// Fields adjacent to `field`.
+inline Bitboard NeighborMask(int field) {
+    return Geometry<H, W>::NEIGHBORS.masks[field];
+}
+
+FLIPPO_ALWAYS_INLINE Bitboard ShiftBits(Bitboard b, int amount) {
+    return amount > 0 ? b << amount : b >> -amount;
+}
+
+// Moves every field in `b` one step in direction `d`, dropping fields that
+// fall off the board.
+FLIPPO_ALWAYS_INLINE Bitboard Shift(Bitboard b, int d) {
+    return ShiftBits(b, ShiftAmount(d)) & DirectionMask(d);
+}
+
+inline Bitboard Neighbors(Bitboard b) {
+    Bitboard result = 0;
+#pragma GCC unroll 8
+    for (int d = 0; d < 8; ++d) result |= Shift(b, d);
+    return result;
+}
+
+// Returns the pieces that are flipped when the player owning `own` places a
+// piece on the empty field `bit`: in each direction, all pieces between the
+// new piece and the farthest piece of the player's own color that can be
+// reached over occupied fields only.
+//
+// Along a ray, the occupied run ends at the nearest empty field, which is the
+// lowest empty bit for directions of increasing field index, and the highest
+// for the others. The farthest own piece is at the opposite extreme.
+inline Bitboard FlipsScalar(Bitboard own, Bitboard occupied, Bitboard bit) {
+    const int field = __builtin_ctzll(bit);
+    Bitboard flips = 0;
+#pragma GCC unroll 8
+    for (int d = 0; d < 8; ++d) {
+        const Bitboard ray = RayMask(d, field);
+        const Bitboard empty = ray & ~occupied;
+        if (ShiftAmount(d) > 0) {
+            const Bitboard run = ray & ((empty & -empty) - 1);
+            const Bitboard ends = run & own;
+            if (ends) flips |= run & ((Bitboard(1) << (63 - __builtin_clzll(ends))) - 1);
+        } else {
+            const Bitboard up_to_empty =
+                empty ? (Bitboard(2) << (63 - __builtin_clzll(empty))) - 1 : 0;
+            const Bitboard run = ray & ~up_to_empty;
+            const Bitboard ends = run & own;
+            if (ends) flips |= run & ~(((ends & -ends) << 1) - 1);
+        }
+    }
+    return flips;
+}
+
+// Calculates for both players the empty fields where they would flip at
+// least one piece. Both fills in a direction share the same propagator, so
+// they are interleaved.
+inline void FlippingMovesScalar(const Bitboard (&pieces)[2], Bitboard (*moves)[2]) {
+    const Bitboard occupied = pieces[0] | pieces[1];
+    Bitboard moves0 = 0, moves1 = 0;
+#pragma GCC unroll 8
+    for (int d = 0; d < 8; ++d) {
+        const int e = 7 - d;
+        const int amount = ShiftAmount(e);
+        Bitboard pro = occupied & DirectionMask(e);
+        Bitboard gen0 = Shift(pieces[0], e) & occupied;
+        Bitboard gen1 = Shift(pieces[1], e) & occupied;
+        for (int n = 1; n < std::max(H, W); n *= 2) {
+            gen0 |= pro & ShiftBits(gen0, amount*n);
+            gen1 |= pro & ShiftBits(gen1, amount*n);
+            pro &= ShiftBits(pro, amount*n);
+        }
+        moves0 |= Shift(gen0, e);
+        moves1 |= Shift(gen1, e);
+    }
+    (*moves)[0] = moves0 & ~occupied;
+    (*moves)[1] = moves1 & ~occupied;
+}
+
+#ifdef __x86_64__
+
+// SSE2, which every x86-64 CPU has: FlippingMovesScalar() with the two
+// players' fills in the two lanes of a vector.
+
+FLIPPO_ALWAYS_INLINE __m128i ShiftLanes(__m128i b, int amount) {
+    return amount > 0 ? _mm_slli_epi64(b, amount) : _mm_srli_epi64(b, -amount);
+}
+
+inline void FlippingMovesSse2(const Bitboard (&pieces)[2], Bitboard (*moves)[2]) {
+    const __m128i own = _mm_set_epi64x(pieces[1], pieces[0]);
+    const __m128i occupied = _mm_set1_epi64x(pieces[0] | pieces[1]);
+    __m128i result = _mm_setzero_si128();
+#pragma GCC unroll 8
+    for (int d = 0; d < 8; ++d) {
+        const int amount = ShiftAmount(d);
+        const __m128i mask = _mm_set1_epi64x(DirectionMask(d));
+        __m128i pro = _mm_and_si128(occupied, mask);
+        __m128i gen = _mm_and_si128(pro, ShiftLanes(own, amount));
+        for (int n = 1; n < std::max(H, W); n *= 2) {
+            gen = _mm_or_si128(gen, _mm_and_si128(pro, ShiftLanes(gen, amount*n)));
+            pro = _mm_and_si128(pro, ShiftLanes(pro, amount*n));
+        }
+        result = _mm_or_si128(result, _mm_and_si128(mask, ShiftLanes(gen, amount)));
+    }
+    result = _mm_andnot_si128(occupied, result);
+    (*moves)[0] = _mm_cvtsi128_si64(result);
+    (*moves)[1] = _mm_cvtsi128_si64(_mm_unpackhi_epi64(result, result));
+}
+
+// AVX2: all 8 directions in two vectors of 4 lanes, since AVX2 can shift each
+// lane by a different amount. Lane k of the "up" vectors handles direction
+// 4 + k, which shifts towards higher fields, and lane k of the "down" vectors
+// handles the opposite direction 3 - k, which shifts by the same amount the
+// other way.
+
+#define FLIPPO_AVX2 __attribute__((target("avx2")))
+
+FLIPPO_AVX2 FLIPPO_ALWAYS_INLINE __m256i UpShifts() {
+    return _mm256_set_epi64x(ShiftAmount(7), ShiftAmount(6), ShiftAmount(5), ShiftAmount(4));
+}
+
+FLIPPO_AVX2 FLIPPO_ALWAYS_INLINE __m256i UpMasks() {
+    return _mm256_set_epi64x(
+        DirectionMask(7), DirectionMask(6), DirectionMask(5), DirectionMask(4));
+}
+
+FLIPPO_AVX2 FLIPPO_ALWAYS_INLINE __m256i DownMasks() {
+    return _mm256_set_epi64x(
+        DirectionMask(0), DirectionMask(1), DirectionMask(2), DirectionMask(3));
+}
+
+FLIPPO_AVX2 FLIPPO_ALWAYS_INLINE Bitboard OrLanes(__m256i v) {
+    const __m128i x = _mm_or_si128(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    return _mm_cvtsi128_si64(_mm_or_si128(x, _mm_unpackhi_epi64(x, x)));
+}
+
+FLIPPO_AVX2 inline void FlippingMovesAvx2(const Bitboard (&pieces)[2], Bitboard (*moves)[2]) {
+    const __m256i shifts = UpShifts();
+    const __m256i up_masks = UpMasks();
+    const __m256i down_masks = DownMasks();
+    const __m256i occupied = _mm256_set1_epi64x(pieces[0] | pieces[1]);
+    const __m256i own0 = _mm256_set1_epi64x(pieces[0]);
+    const __m256i own1 = _mm256_set1_epi64x(pieces[1]);
+    __m256i up_pro = _mm256_and_si256(occupied, up_masks);
+    __m256i down_pro = _mm256_and_si256(occupied, down_masks);
+    __m256i up0 = _mm256_and_si256(up_pro, _mm256_sllv_epi64(own0, shifts));
+    __m256i up1 = _mm256_and_si256(up_pro, _mm256_sllv_epi64(own1, shifts));
+    __m256i down0 = _mm256_and_si256(down_pro, _mm256_srlv_epi64(own0, shifts));
+    __m256i down1 = _mm256_and_si256(down_pro, _mm256_srlv_epi64(own1, shifts));
+    __m256i n_shifts = shifts;
+    for (int n = 1; n < std::max(H, W); n *= 2) {
+        up0 = _mm256_or_si256(up0, _mm256_and_si256(up_pro, _mm256_sllv_epi64(up0, n_shifts)));
+        up1 = _mm256_or_si256(up1, _mm256_and_si256(up_pro, _mm256_sllv_epi64(up1, n_shifts)));
+        down0 = _mm256_or_si256(down0,
+            _mm256_and_si256(down_pro, _mm256_srlv_epi64(down0, n_shifts)));
+        down1 = _mm256_or_si256(down1,
+            _mm256_and_si256(down_pro, _mm256_srlv_epi64(down1, n_shifts)));
+        up_pro = _mm256_and_si256(up_pro, _mm256_sllv_epi64(up_pro, n_shifts));
+        down_pro = _mm256_and_si256(down_pro, _mm256_srlv_epi64(down_pro, n_shifts));
+        n_shifts = _mm256_add_epi64(n_shifts, n_shifts);
+    }
+    const __m256i moves0 = _mm256_or_si256(
+        _mm256_and_si256(up_masks, _mm256_sllv_epi64(up0, shifts)),
+        _mm256_and_si256(down_masks, _mm256_srlv_epi64(down0, shifts)));
+    const __m256i moves1 = _mm256_or_si256(
+        _mm256_and_si256(up_masks, _mm256_sllv_epi64(up1, shifts)),
+        _mm256_and_si256(down_masks, _mm256_srlv_epi64(down1, shifts)));
+    const Bitboard empty = ~(pieces[0] | pieces[1]);
+    (*moves)[0] = OrLanes(moves0) & empty;
+    (*moves)[1] = OrLanes(moves1) & empty;
+}
+
+// Flips() with Kogge-Stone fills: in each direction, the run of occupied fields
+// from the new piece, and then a fill back from the own pieces on the run.
+FLIPPO_AVX2 inline Bitboard FlipsAvx2(Bitboard own_bits, Bitboard occupied_bits, Bitboard bit) {
+    const __m256i shifts = UpShifts();
+    const __m256i up_masks = UpMasks();
+    const __m256i down_masks = DownMasks();
+    const __m256i new_piece = _mm256_set1_epi64x(bit);
+    const __m256i occupied = _mm256_set1_epi64x(occupied_bits);
+    __m256i up_pro = _mm256_and_si256(occupied, up_masks);
+    __m256i down_pro = _mm256_and_si256(occupied, down_masks);
+    __m256i up_line = new_piece;
+    __m256i down_line = new_piece;
+    __m256i n_shifts = shifts;
+    for (int n = 1; n < std::max(H, W); n *= 2) {
+        up_line = _mm256_or_si256(up_line,
+            _mm256_and_si256(up_pro, _mm256_sllv_epi64(up_line, n_shifts)));
+        down_line = _mm256_or_si256(down_line,
+            _mm256_and_si256(down_pro, _mm256_srlv_epi64(down_line, n_shifts)));
+        up_pro = _mm256_and_si256(up_pro, _mm256_sllv_epi64(up_pro, n_shifts));
+        down_pro = _mm256_and_si256(down_pro, _mm256_srlv_epi64(down_pro, n_shifts));
+        n_shifts = _mm256_add_epi64(n_shifts, n_shifts);
+    }
+    up_line = _mm256_andnot_si256(new_piece, up_line);
+    down_line = _mm256_andnot_si256(new_piece, down_line);
+    const __m256i own = _mm256_set1_epi64x(own_bits);
+    // An up line fills back down, and vice versa.
+    __m256i up_back = _mm256_and_si256(up_line, own);
+    __m256i down_back = _mm256_and_si256(down_line, own);
+    up_pro = down_masks;
+    down_pro = up_masks;
+    n_shifts = shifts;
+    for (int n = 1; n < std::max(H, W); n *= 2) {
+        up_back = _mm256_or_si256(up_back,
+            _mm256_and_si256(up_pro, _mm256_srlv_epi64(up_back, n_shifts)));
+        down_back = _mm256_or_si256(down_back,
+            _mm256_and_si256(down_pro, _mm256_sllv_epi64(down_back, n_shifts)));
+        up_pro = _mm256_and_si256(up_pro, _mm256_srlv_epi64(up_pro, n_shifts));
+        down_pro = _mm256_and_si256(down_pro, _mm256_sllv_epi64(down_pro, n_shifts));
+        n_shifts = _mm256_add_epi64(n_shifts, n_shifts);
+    }
+    const __m256i up_flips = _mm256_and_si256(up_line,
+        _mm256_and_si256(down_masks, _mm256_srlv_epi64(up_back, shifts)));
+    const __m256i down_flips = _mm256_and_si256(down_line,
+        _mm256_and_si256(up_masks, _mm256_sllv_epi64(down_back, shifts)));
+    return OrLanes(_mm256_or_si256(up_flips, down_flips));
+}
+
+#endif  // __x86_64__
+
+typedef Bitboard FlipsFunction(Bitboard own, Bitboard occupied, Bitboard bit);
+typedef void FlippingMovesFunction(const Bitboard (&pieces)[2], Bitboard (*moves)[2]);
+
+// An implementation of move generation for an instruction set.
+struct MoveGeneration {
+    const char *name;
+    FlipsFunction *flips;
+    FlippingMovesFunction *flipping_moves;
+};
+
+// Returns the implementations that the CPU supports, from best to worst,
+// ending with the portable one. The list is terminated by a null name.
+inline const MoveGeneration *SupportedMoveGenerations() {
+#ifdef __x86_64__
+    static const MoveGeneration all[] = {
+        {"avx2", FlipsAvx2, FlippingMovesAvx2},
+        {"sse2", FlipsScalar, FlippingMovesSse2},
+        {"scalar", FlipsScalar, FlippingMovesScalar},
+        {nullptr, nullptr, nullptr},
+    };
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? &all[0] : &all[1];
+#else
+    static const MoveGeneration all[] = {
+        {"scalar", FlipsScalar, FlippingMovesScalar},
+        {nullptr, nullptr, nullptr},
+    };
+    return &all[0];
+#endif
+}
+
+// The implementation used by Flips() and FlippingMoves(): the best supported
+// one, unless changed with SelectMoveGeneration().
+inline MoveGeneration &ActiveMoveGeneration() {
+    static MoveGeneration active = SupportedMoveGenerations()[0];
+    return active;
+}
+
+// Selects the supported implementation named `name`, e.g. to compare them.
+// Returns false if there is no such implementation.
+inline bool SelectMoveGeneration(const std::string &name) {
+    for (const MoveGeneration *g = SupportedMoveGenerations(); g->name != nullptr; ++g) {
+        if (g->name == name) {
+            ActiveMoveGeneration() = *g;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline Bitboard Flips(Bitboard own, Bitboard occupied, Bitboard bit) {
+    return ActiveMoveGeneration().flips(own, occupied, bit);
+}
+
+inline void FlippingMoves(const Bitboard (&pieces)[2], Bitboard (*moves)[2]) {
+    ActiveMoveGeneration().flipping_moves(pieces, moves);
+}
+
+// Returns the valid moves, given the player's flipping moves: those, or if
+// there are none, all empty fields adjacent to an occupied field.
+inline Bitboard ValidMoves(Bitboard flipping_moves, Bitboard occupied) {
+    return flipping_moves ? flipping_moves : Neighbors(occupied) & ~occupied;
+}
+
+inline std::string FormatMove(const Move &move) {
+    std::string s(2, '\0');
+    s[0] = char('A' + move.row);
+    s[1] = char('1' + move.col);
+    return s;
+}
+
+inline bool ParseMove(const std::string &s, Move *move) {
+    if (s.size() != 2) return false;
+    int row = s[0] - 'A';
+    int col = s[1] - '1';
+    if (!ValidCoords(row, col)) return false;
+    *move = Move(row, col);
+    return true;
+}
+
+// A position without any search state, for arbitrating and analyzing games.
+struct Position {
+    Bitboard pieces[2];  // indexed by player
+    int moves_played;
+};
+
+inline Position InitialPosition() {
+    Position position;
+    position.pieces[0] = Bit(H/2 - 1, W/2 - 1) | Bit(H/2 - 0, W/2 - 0);
+    position.pieces[1] = Bit(H/2 - 1, W/2 - 0) | Bit(H/2 - 0, W/2 - 1);
+    position.moves_played = 0;
+    return position;
+}
+
+inline bool IsGameOver(const Position &position) {
+    return position.moves_played >= MAX_MOVES;
+}
+
+inline int NextPlayer(const Position &position) {
+    return position.moves_played & 1;
+}
+
+inline Bitboard Occupied(const Position &position) {
+    return position.pieces[0] | position.pieces[1];
+}
+
+inline Bitboard ValidMoves(const Position &position) {
+    Bitboard flipping_moves[2];
+    FlippingMoves(position.pieces, &flipping_moves);
+    return ValidMoves(flipping_moves[NextPlayer(position)], Occupied(position));
+}
+
+// Plays a move, which must be valid.
+inline void ExecuteMove(Position *position, const Move &move) {
+    const int i = NextPlayer(*position);
+    const Bitboard bit = Bit(move);
+    const Bitboard flips = Flips(position->pieces[i], Occupied(*position), bit);
+    position->pieces[i] ^= flips | bit;
+    position->pieces[1 - i] ^= flips;
+    position->moves_played += 1;
+}
+
+// Returns the number of white pieces minus the number of black pieces.
+inline int Score(const Position &position) {
+    return __builtin_popcountll(position.pieces[0]) - __builtin_popcountll(position.pieces[1]);
+}
+
+// The score recorded for a game in which a player failed (made an invalid
+// move, or ran out of time): a win by this margin for the opponent, which no
+// regular game end reaches.
+const int FAILURE_SCORE = 99;
+
+// Symmetries of the board, which map positions to equivalent positions. Bit 2
+// of a symmetry transposes the board (only if it is square), then bit 1
+// mirrors the rows and bit 0 mirrors the columns.
+const int NUM_SYMMETRIES = H == W ? 8 : 4;
+
+inline int TransformField(int symmetry, int field) {
+    int r = field / W, c = field % W;
+    if (symmetry & 4) std::swap(r, c);
+    if (symmetry & 2) r = H - 1 - r;
+    if (symmetry & 1) c = W - 1 - c;
+    return r*W + c;
+}
+
+inline int InverseTransformField(int symmetry, int field) {
+    int r = field / W, c = field % W;
+    if (symmetry & 1) c = W - 1 - c;
+    if (symmetry & 2) r = H - 1 - r;
+    if (symmetry & 4) std::swap(r, c);
+    return r*W + c;
+}
+
+// Mirrors the rows of an 8x8 board: row r becomes row 7 - r.
+inline Bitboard MirrorRows(Bitboard b) {
+    return __builtin_bswap64(b);
+}
+
+// Mirrors the columns of an 8x8 board: column c becomes column 7 - c.
+inline Bitboard MirrorColumns(Bitboard b) {
+    b = ((b >> 1) & 0x5555555555555555ull) | ((b & 0x5555555555555555ull) << 1);
+    b = ((b >> 2) & 0x3333333333333333ull) | ((b & 0x3333333333333333ull) << 2);
+    return ((b >> 4) & 0x0f0f0f0f0f0f0f0full) | ((b & 0x0f0f0f0f0f0f0f0full) << 4);
+}
+
+// Transposes an 8x8 board, by swapping 4x4, then 2x2, then 1x1 blocks across
+// the main diagonal.
+inline Bitboard Transpose(Bitboard b) {
+    Bitboard t = 0x0f0f0f0f00000000ull & (b ^ (b << 28));
+    b ^= t ^ (t >> 28);
+    t = 0x3333000033330000ull & (b ^ (b << 14));
+    b ^= t ^ (t >> 14);
+    t = 0x5500550055005500ull & (b ^ (b << 7));
+    return b ^ t ^ (t >> 7);
+}
+
+inline Bitboard Transform(int symmetry, Bitboard b) {
+    if (H != 8 || W != 8) {
+        Bitboard result = 0;
+        for (; b; b &= b - 1) result |= Bitboard(1) << TransformField(symmetry, __builtin_ctzll(b));
+        return result;
+    }
+    if (symmetry & 4) b = Transpose(b);
+    if (symmetry & 2) b = MirrorRows(b);
+    if (symmetry & 1) b = MirrorColumns(b);
+    return b;
+}
+
+// The splitmix64 finalizer: a bijection that mixes all bits.
+inline uint64_t Mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// A hash of the pieces that is stable across builds, so it can be stored in
+// files.
+inline uint64_t PositionKey(Bitboard white, Bitboard black) {
+    return Mix64(white ^ Mix64(black ^ 0x9e3779b97f4a7c15ull));
+}
+
+// Returns the smallest PositionKey() over all symmetric images of `pieces`,
+// which is the same for all equivalent positions, and sets `*symmetry` to the
+// symmetry that maps `pieces` to that image.
+inline uint64_t CanonicalKey(const Bitboard (&pieces)[2], int *symmetry) {
+    uint64_t best_key = PositionKey(pieces[0], pieces[1]);
+    *symmetry = 0;
+    for (int s = 1; s < NUM_SYMMETRIES; ++s) {
+        const uint64_t key = PositionKey(Transform(s, pieces[0]), Transform(s, pieces[1]));
+        if (key < best_key) {
+            best_key = key;
+            *symmetry = s;
+        }
+    }
+    return best_key;
+}
+
+}  // namespace flippo
+
+#endif  // FLIPPO_RULES_H
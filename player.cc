@@ -1,26 +1,61 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <set>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
+#include "flippo_rules.h"
+
+#ifdef FLIPPO_PLUGIN
+#include "flippo_plugin.h"
+#endif
+
 #define UNLIKELY(c) __builtin_expect((c), 0)
 #define CHECK(c) if (!UNLIKELY(c)) CheckFailed(#c, __FILE__, __LINE__);
 #define CHECK_EQ(a, b) CHECK((a) == (b))
 
+// Counting of search events for the statistics logged after each move (see
+// SearchStats). Off unless SEARCH_STATS is defined as 1, so that competition
+// builds don't pay for it.
+#ifndef SEARCH_STATS
+#define SEARCH_STATS 0
+#endif
+#if SEARCH_STATS
+#define STAT(counter) (++search_stats.counter)
+#else
+#define STAT(counter) ((void)0)
+#endif
+
 #define FOR(i, a, b) for (int i = int(a); i < int(b); ++i)
 #define REP(i, n) FOR(i, 0, n)
 
 namespace {
 
-const int H = 8;
-const int W = 8;
+using namespace flippo;
+
 const int MIN_VALUE = -9999;
 const int MAX_VALUE = +9999;
-const int MAX_MOVES = 60;  // TODO: prove a lower bound?
 
 enum class Player : signed char { NONE = 0, WHITE = 1, BLACK = -1 };
 
@@ -28,32 +63,92 @@ Player Other(Player p) {
     return static_cast<Player>(-static_cast<int>(p));
 }
 
+// Index of the player's pieces in Board::pieces.
+int Index(Player p) {
+    return p == Player::WHITE ? 0 : 1;
+}
+
+// Patterns of fields whose contents, as base-3 digits (0 for an empty field, 1
+// for white and 2 for black), index tables of evaluation weights (see
+// EvaluatePatterns()). Each pattern has an instance for each of its images
+// under the board's symmetries, which lists the fields in the corresponding
+// order, so that all instances share the pattern's table.
+enum PatternId { EDGE_PATTERN, CORNER_PATTERN, DIAGONAL_PATTERN, NUM_PATTERNS };
+
+// The patterns are laid out for an 8x8 board. On other boards, positions are
+// always evaluated by the hand-written terms of Evaluate().
+const bool PATTERNS_SUPPORTED = H == 8 && W == 8;
+const int PATTERN_SIZES[NUM_PATTERNS] = {8, 9, 8};
+const int MAX_PATTERN_SIZE = 9;
+const int NUM_PATTERN_INSTANCES = 10;  // 4 edges, 4 corners and 2 diagonals
+const int PATTERN_LANES = 16;          // instances rounded up for vectorization
+
+// Evaluation terms of a position. DoMove() computes them for each new
+// position, and keeps those of earlier positions so UndoMove() can restore
+// them without recomputing.
+struct PositionState {
+    Bitboard mobility[2];  // FlippingMoves() per player, indexed by Index()
+    int discs[2];          // number of pieces per player, indexed by Index()
+    Bitboard flips;        // pieces flipped by the last move
+    Bitboard frontier;     // empty fields adjacent to an occupied field
+    uint16_t patterns[PATTERN_LANES];  // index of each pattern instance
+};
+
 struct Board {
-    Player fields[H][W];
+    Bitboard pieces[2];  // indexed by Index(player)
     Player next_player;
+    uint64_t hash;  // Zobrist hash of `pieces`
+    int moves_played;
+    PositionState states[MAX_MOVES + 1];  // indexed by moves_played
 };
 
-struct Move {
-    Move() : row(0), col(0) {}
-    constexpr Move(int row, int col) : row(row), col(col) {}
+unsigned rng_seed = ((unsigned)getpid() << 16) ^ (unsigned)time(NULL); 
+
+// Destination of diagnostic output about the search.
+std::ostream *log_stream = &std::cerr;
 
-    short row, col;
+// Random keys for Zobrist hashing. The player to move is not hashed, since it
+// follows from the number of occupied fields.
+struct ZobristKeys {
+    ZobristKeys() {
+        uint64_t x = 0x0123456789abcdefull;
+        REP(i, H*W) {
+            REP(j, 2) {
+                // splitmix64
+                uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+                pieces[j][i] = z ^ (z >> 31);
+            }
+            flip[i] = pieces[0][i] ^ pieces[1][i];
+        }
+    }
+
+    uint64_t pieces[2][H*W];
+    uint64_t flip[H*W];  // pieces[0][i] ^ pieces[1][i]
 };
 
-unsigned rng_seed = ((unsigned)getpid() << 16) ^ (unsigned)time(NULL); 
+const ZobristKeys zobrist;
 
-bool ValidCoords(int r, int c) {
-    return r >= 0 && r < W && c >= 0 && c < W;
+uint64_t ComputeHash(const Board &board) {
+    uint64_t hash = 0;
+    REP(j, 2) {
+        for (Bitboard b = board.pieces[j]; b; b &= b - 1) {
+            hash ^= zobrist.pieces[j][__builtin_ctzll(b)];
+        }
+    }
+    return hash;
 }
 
-bool operator==(const Board &a, const Board &b) {
-    REP(r, H) REP(c, W) if (a.fields[r][c] != b.fields[r][c]) return false;
-    if (a.next_player != b.next_player) return false;
-    return true;
+uint64_t FlipsHash(Bitboard flips) {
+    uint64_t hash = 0;
+    for (; flips; flips &= flips - 1) hash ^= zobrist.flip[__builtin_ctzll(flips)];
+    return hash;
 }
 
-bool operator==(const Move &a, const Move &b) {
-    return a.row == b.row && a.col == b.col;
+bool operator==(const Board &a, const Board &b) {
+    return a.pieces[0] == b.pieces[0] && a.pieces[1] == b.pieces[1] &&
+        a.next_player == b.next_player && a.hash == b.hash;
 }
 
 void CheckFailed(const char *condition, const char *file, int line) {
@@ -61,213 +156,1577 @@ void CheckFailed(const char *condition, const char *file, int line) {
     abort();
 }
 
-Board InitialBoard() {
-    Board board = {{}, Player::WHITE};
-    board.fields[H/2 - 1][W/2 - 1] = Player::WHITE;
-    board.fields[H/2 - 1][W/2 - 0] = Player::BLACK;
-    board.fields[H/2 - 0][W/2 - 1] = Player::BLACK;
-    board.fields[H/2 - 0][W/2 - 0] = Player::WHITE;
-    return board;
-}
-
-bool HasFlips(const Player (&fields)[H][W], Player p, int r, int c) {
-    for (int dr = -1; dr <= +1; ++dr) {
-        for (int dc = -1; dc <= +1; ++dc) {
-            if (dr || dc) {
-                for (int n = 1; ; ++n) {
-                    int r2 = r + dr*n;
-                    int c2 = c + dc*n;
-                    if (!ValidCoords(r2, c2)) break;
-                    Player o = fields[r2][c2];
-                    if (o == Player::NONE) break;
-                    if (o == p && n > 1) return true;
+struct PatternTables {
+    PatternTables() {
+        if (!PATTERNS_SUPPORTED) return;
+        // Image of the pattern in the A1 corner, under each symmetry.
+        int base[NUM_PATTERNS][MAX_PATTERN_SIZE];
+        REP(i, W) base[EDGE_PATTERN][i] = FieldIndex(Move(0, i));
+        REP(i, 9) base[CORNER_PATTERN][i] = FieldIndex(Move(i/3, i%3));
+        REP(i, H) base[DIAGONAL_PATTERN][i] = FieldIndex(Move(i, i));
+        int n = 0;
+        REP(p, NUM_PATTERNS) {
+            std::vector<Bitboard> images;
+            REP(s, NUM_SYMMETRIES) {
+                Bitboard image = 0;
+                REP(i, PATTERN_SIZES[p]) image |= Bitboard(1) << TransformField(s, base[p][i]);
+                if (std::find(images.begin(), images.end(), image) != images.end()) continue;
+                images.push_back(image);
+                CHECK(n < NUM_PATTERN_INSTANCES);
+                pattern[n] = p;
+                int power = 1;
+                REP(i, PATTERN_SIZES[p]) {
+                    field_powers[TransformField(s, base[p][i])][n] = power;
+                    power *= 3;
                 }
+                ++n;
             }
         }
-    }
-    return false;
-}
-
-void DoFlips(Player (*fields)[H][W], Player p, int r, int c) {
-    for (int dr = -1; dr <= +1; ++dr) {
-        for (int dc = -1; dc <= +1; ++dc) {
-            if (dr || dc) {
-                int last_n = 0;
-                for (int n = 1; ; ++n) {
-                    int r2 = r + dr*n;
-                    int c2 = c + dc*n;
-                    if (!ValidCoords(r2, c2)) break;
-                    Player o = (*fields)[r2][c2];
-                    if (o == Player::NONE) break;
-                    if (o == p) last_n = n;
+        CHECK_EQ(n, NUM_PATTERN_INSTANCES);
+        // An instance reads its fields in the order of one of the symmetries
+        // that map the pattern onto them. The others, which differ from it by
+        // a symmetry of the pattern itself, read them in another order (the
+        // edge's fields reversed, say): give each index the least of the
+        // indices of its orders, so positions related by a symmetry have the
+        // same features.
+        REP(p, NUM_PATTERNS) {
+            const int size = PATTERN_SIZES[p];
+            std::vector<std::vector<int>> orders;
+            REP(s, NUM_SYMMETRIES) {
+                std::vector<int> order(size, -1);
+                REP(i, size) REP(j, size) {
+                    if (TransformField(s, base[p][i]) == base[p][j]) order[i] = j;
                 }
-                for (int n = 1; n < last_n; ++n) {
-                    Player &o = (*fields)[r + n*dr][c + n*dc];
-                    o = Other(o);
+                if (std::find(order.begin(), order.end(), -1) == order.end()) orders.push_back(order);
+            }
+            int powers[MAX_PATTERN_SIZE + 1] = {1};
+            REP(i, size) powers[i + 1] = 3*powers[i];
+            REP(index, powers[size]) {
+                int least = index;
+                for (const std::vector<int> &order : orders) {
+                    int reordered = 0;
+                    REP(i, size) reordered += index/powers[i] % 3*powers[order[i]];
+                    least = std::min(least, reordered);
                 }
+                symmetric_index[p][index] = least;
+            }
+        }
+        // Swapping the colors swaps digits 1 and 2.
+        REP(index, int(sizeof(swap_colors)/sizeof(swap_colors[0]))) {
+            int swapped = 0;
+            for (int i = index, power = 1; i > 0; i /= 3, power *= 3) {
+                swapped += (i % 3 == 0 ? 0 : 3 - i % 3)*power;
             }
+            swap_colors[index] = swapped;
+        }
+    }
+
+    int pattern[NUM_PATTERN_INSTANCES];  // PatternId of each instance
+    // Power of each field's digit in the index of each instance, or 0.
+    alignas(32) uint16_t field_powers[H*W][PATTERN_LANES] = {};
+    uint16_t swap_colors[19683];  // 3^MAX_PATTERN_SIZE
+    // The least index of the same fields in another order, by PatternId.
+    uint16_t symmetric_index[NUM_PATTERNS][19683];
+};
+
+const PatternTables pattern_tables;
+
+void ComputePatterns(const Bitboard (&pieces)[2], uint16_t (*patterns)[PATTERN_LANES]) {
+    REP(k, PATTERN_LANES) (*patterns)[k] = 0;
+    REP(j, 2) {
+        for (Bitboard b = pieces[j]; b; b &= b - 1) {
+            const uint16_t *powers = pattern_tables.field_powers[__builtin_ctzll(b)];
+            REP(k, PATTERN_LANES) (*patterns)[k] += (j + 1)*powers[k];
         }
     }
 }
 
-bool HasOccupiedNeighbor(const Player (&fields)[H][W], int r, int c) {
-    CHECK_EQ(fields[r][c], Player::NONE);
-    int min_r = r > 0 ? r - 1 : 0;
-    int max_r = r < H - 1 ? r + 1 : H - 1;
-    int min_c = c > 0 ? c - 1 : 0;
-    int max_c = c < W - 1 ? c + 1 : W - 1;
-    for (int r2 = min_r; r2 <= max_r; ++r2) {
-        for (int c2 = min_c; c2 <= max_c; ++c2) {
-            if (fields[r2][c2] != Player::NONE) return true;
+// Sets `patterns` to the pattern indices after a move by player `i` on
+// `field` that flips `flips`, given the indices before it and the opponent's
+// pieces after it.
+void UpdatePatterns(int i, int field, Bitboard flips, Bitboard opponent,
+        const uint16_t (&before)[PATTERN_LANES], uint16_t (*patterns)[PATTERN_LANES]) {
+    // Flipping an opponent's piece changes its digit from 2 - i to i + 1, and
+    // flipping one of our own changes it back.
+    int16_t flipped[PATTERN_LANES] = {};
+    for (Bitboard b = flips & ~opponent; b; b &= b - 1) {
+        const uint16_t *powers = pattern_tables.field_powers[__builtin_ctzll(b)];
+        REP(k, PATTERN_LANES) flipped[k] += powers[k];
+    }
+    for (Bitboard b = flips & opponent; b; b &= b - 1) {
+        const uint16_t *powers = pattern_tables.field_powers[__builtin_ctzll(b)];
+        REP(k, PATTERN_LANES) flipped[k] -= powers[k];
+    }
+    const int sign = 2*i - 1;
+    const uint16_t *powers = pattern_tables.field_powers[field];
+    REP(k, PATTERN_LANES) (*patterns)[k] = before[k] + (i + 1)*powers[k] + sign*flipped[k];
+}
+
+// A read-only memory mapping of a whole file.
+class MappedFile {
+public:
+    ~MappedFile() { Close(); }
+
+    bool IsOpen() const { return data != nullptr; }
+    const void *Data() const { return data; }
+    size_t Size() const { return size; }
+
+    // Maps the file at `path`. Returns false, after logging the reason, if it
+    // can't be mapped.
+    bool Open(const char *path) {
+        Close();
+        const int fd = open(path, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        void *map = MAP_FAILED;
+        int error = EINVAL;  // for empty files, which can't be mapped
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            error = errno;
+        } else if (st.st_size > 0) {
+            map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            error = errno;
         }
+        if (fd >= 0) close(fd);
+        if (map == MAP_FAILED) {
+            std::cerr << "Cannot map [" << path << "]: " << strerror(error) << '\n';
+            return false;
+        }
+        data = map;
+        size = st.st_size;
+        return true;
     }
-    return false;
+
+    void Close() {
+        if (data) munmap(data, size);
+        data = nullptr;
+        size = 0;
+    }
+
+private:
+    void *data = nullptr;
+    size_t size = 0;
+};
+
+// Memory reserved in a single mapping when the player starts, from which the
+// search's tables are allocated, so that its memory use is fixed up front.
+// Optionally backed by large pages, which make fewer TLB misses on large
+// tables.
+class Arena {
+public:
+    ~Arena() { Release(); }
+
+    size_t Size() const { return size; }
+    size_t Used() const { return used; }
+    const char *PageType() const { return page_type; }
+
+    // Maps `bytes` of zeroed memory, releasing the current mapping. With
+    // `large_pages`, uses explicit huge pages if enough are available, and
+    // otherwise asks for transparent huge pages. Returns false, after logging
+    // the reason, if the memory can't be mapped.
+    bool Reserve(size_t bytes, bool large_pages) {
+        Release();
+        bytes = std::max<size_t>(bytes, 1);
+        void *map = MAP_FAILED;
+        page_type = "normal";
+        if (large_pages) {
+            const size_t large = (bytes + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+            map = mmap(nullptr, large, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (map != MAP_FAILED) {
+                bytes = large;
+                page_type = "hugetlb";
+            }
+        }
+        if (map == MAP_FAILED) {
+            map = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (map == MAP_FAILED) {
+                std::cerr << "Cannot map " << bytes << " bytes: " << strerror(errno) << '\n';
+                return false;
+            }
+            if (large_pages && madvise(map, bytes, MADV_HUGEPAGE) == 0) page_type = "transparent";
+        }
+        data = static_cast<char*>(map);
+        size = bytes;
+        return true;
+    }
+
+    void Release() {
+        if (data) munmap(data, size);
+        data = nullptr;
+        size = used = 0;
+    }
+
+    // Returns `bytes` of the reserved memory, aligned to `alignment` (a power of
+    // two). There must be enough left.
+    void *Allocate(size_t bytes, size_t alignment) {
+        const size_t start = (used + alignment - 1) & ~(alignment - 1);
+        CHECK(start + bytes <= size);
+        used = start + bytes;
+        return data + start;
+    }
+
+    static const size_t LARGE_PAGE_SIZE = 2 << 20;
+
+private:
+    char *data = nullptr;
+    size_t size = 0;
+    size_t used = 0;
+    const char *page_type = "normal";
+};
+
+Arena search_arena;
+
+// The mapped weights file, and its weights, or null to use the default
+// evaluation.
+MappedFile weights_file;
+const int16_t *pattern_weights = nullptr;
+
+const PositionState &State(const Board &board) {
+    return board.states[board.moves_played];
+}
+
+void UpdateState(Board *board) {
+    PositionState &state = board->states[board->moves_played];
+    FlippingMoves(board->pieces, &state.mobility);
+    REP(i, 2) state.discs[i] = __builtin_popcountll(board->pieces[i]);
+}
+
+Board InitialBoard() {
+    const Position position = InitialPosition();
+    Board board = {{position.pieces[0], position.pieces[1]}, Player::WHITE};
+    board.hash = ComputeHash(board);
+    board.moves_played = 0;
+    const Bitboard occupied = flippo::Occupied(position);
+    board.states[0].frontier = Neighbors(occupied) & ~occupied;
+    if (PATTERNS_SUPPORTED) ComputePatterns(board.pieces, &board.states[0].patterns);
+    UpdateState(&board);
+    return board;
+}
+
+Bitboard Occupied(const Board &board) {
+    return board.pieces[0] | board.pieces[1];
+}
+
+int Empties(const Board &board) {
+    return H*W - __builtin_popcountll(Occupied(board));
 }
 
 void DoMove(Board *board, Move move) {
-    Player (&fields)[H][W] = board->fields;
-    Player p = board->next_player;
-    CHECK_EQ(fields[move.row][move.col], Player::NONE);
-    fields[move.row][move.col] = p;
-    DoFlips(&fields, p, move.row, move.col);
-    board->next_player = Other(p);
+    const int i = Index(board->next_player);
+    const Bitboard bit = Bit(move);
+    const Bitboard occupied = Occupied(*board);
+    CHECK_EQ(occupied & bit, 0);
+    const Bitboard flips = Flips(board->pieces[i], occupied, bit);
+    board->pieces[i] ^= flips | bit;
+    board->pieces[1 - i] ^= flips;
+    board->next_player = Other(board->next_player);
+    board->hash ^= zobrist.pieces[i][FieldIndex(move)] ^ FlipsHash(flips);
+    CHECK(board->moves_played < MAX_MOVES);
+    PositionState &state = board->states[board->moves_played + 1];
+    state.flips = flips;
+    state.frontier = (State(*board).frontier | NeighborMask(FieldIndex(move))) & ~(occupied | bit);
+    if (PATTERNS_SUPPORTED && pattern_weights) {
+        UpdatePatterns(i, FieldIndex(move), flips, board->pieces[1 - i], State(*board).patterns,
+            &state.patterns);
+    }
+    board->moves_played += 1;
+    UpdateState(board);
 }
 
 void UndoMove(Board *board, Move move) {
-    Player (&fields)[H][W] = board->fields;
-    Player p = Other(board->next_player);
-    CHECK_EQ(fields[move.row][move.col], p);
-    fields[move.row][move.col] = Player::NONE;
-    DoFlips(&fields, p, move.row, move.col);
+    const Player p = Other(board->next_player);
+    const int i = Index(p);
+    const Bitboard bit = Bit(move);
+    CHECK(board->pieces[i] & bit);
+    const Bitboard flips = State(*board).flips;
+    board->pieces[i] ^= flips | bit;
+    board->pieces[1 - i] ^= flips;
     board->next_player = p;
+    board->hash ^= zobrist.pieces[i][FieldIndex(move)] ^ FlipsHash(flips);
+    board->moves_played -= 1;
+}
+
+// Returns the valid moves: the flipping moves, or if there are none, the
+// frontier (see flippo::ValidMoves()).
+Bitboard ValidMoves(const Board &board) {
+    const PositionState &state = State(board);
+    const Bitboard moves = state.mobility[Index(board.next_player)];
+    return moves ? moves : state.frontier;
 }
 
 int ListMoves(const Board &board, Move (*moves)[MAX_MOVES]) {
-    const Player (&fields)[H][W] = board.fields;
-    const Player p = board.next_player;
-    int total_moves = 0;
-    REP(r, H) REP(c, W) {
-        if (fields[r][c] == Player::NONE && HasOccupiedNeighbor(fields, r, c)) {
-            (*moves)[total_moves++] = Move(r, c);
+    int num_moves = 0;
+    for (Bitboard b = ValidMoves(board); b; b &= b - 1) {
+        (*moves)[num_moves++] = FieldMove(__builtin_ctzll(b));
+    }
+    return num_moves;
+}
+
+// Weights of the pattern evaluation, in 1/EVAL_SCALE discs, by game phase.
+// Each phase has a table per pattern, indexed with digit 1 for the player to
+// move and 2 for the opponent, and a table indexed by the mobility difference.
+// Of the indices of a pattern's fields in different orders, only the least is
+// used (see PatternTables::symmetric_index).
+const int NUM_PHASES = 6;
+const int PHASE_LENGTH = MAX_MOVES/NUM_PHASES;  // moves
+const int EVAL_SCALE = 16;
+const int PATTERN_OFFSETS[NUM_PATTERNS] = {0, 6561, 6561 + 19683};
+const int MOBILITY_OFFSET = 6561 + 19683 + 6561;
+const int MOBILITY_RANGE = 32;
+const int PHASE_WEIGHTS = MOBILITY_OFFSET + 2*MOBILITY_RANGE + 1;
+const int NUM_FEATURES = NUM_PATTERN_INSTANCES + 1;
+
+// A weights file is a WeightsHeader followed by the int16_t weights of each
+// phase, in native byte order.
+const char WEIGHTS_MAGIC[8] = {'F', 'L', 'I', 'P', 'W', 'G', 'T', 'S'};
+
+struct WeightsHeader {
+    char magic[8];
+    uint32_t num_phases;
+    uint32_t phase_weights;
+};
+
+// Maps the weights file at `path`. Returns false, after logging the reason,
+// if it's invalid.
+bool LoadWeights(const char *path) {
+    pattern_weights = nullptr;
+    if (!PATTERNS_SUPPORTED) {
+        std::cerr << "Pattern weights need an 8x8 board [" << path << "]\n";
+        return false;
+    }
+    if (!weights_file.Open(path)) return false;
+    const WeightsHeader *header = static_cast<const WeightsHeader*>(weights_file.Data());
+    if (weights_file.Size() != sizeof(WeightsHeader) + NUM_PHASES*PHASE_WEIGHTS*sizeof(int16_t) ||
+            memcmp(header->magic, WEIGHTS_MAGIC, sizeof(WEIGHTS_MAGIC)) != 0 ||
+            header->num_phases != NUM_PHASES || header->phase_weights != PHASE_WEIGHTS) {
+        std::cerr << "Invalid weights [" << path << "]\n";
+        weights_file.Close();
+        return false;
+    }
+    pattern_weights = reinterpret_cast<const int16_t*>(header + 1);
+    return true;
+}
+
+int Phase(int moves_played) {
+    return std::min(moves_played/PHASE_LENGTH, NUM_PHASES - 1);
+}
+
+// Sets `features` to the indices into a phase's weights of the features of a
+// position with the given pattern indices and flipping moves, for player `i`
+// to move.
+void EvaluationFeatures(const uint16_t (&patterns)[PATTERN_LANES], const Bitboard (&mobility)[2],
+        int i, int (*features)[NUM_FEATURES]) {
+    REP(k, NUM_PATTERN_INSTANCES) {
+        const int p = pattern_tables.pattern[k];
+        const int index = i == 0 ? patterns[k] : pattern_tables.swap_colors[patterns[k]];
+        (*features)[k] = PATTERN_OFFSETS[p] + pattern_tables.symmetric_index[p][index];
+    }
+    const int difference = __builtin_popcountll(mobility[i]) - __builtin_popcountll(mobility[1 - i]);
+    (*features)[NUM_PATTERN_INSTANCES] = MOBILITY_OFFSET + MOBILITY_RANGE +
+        std::max(-MOBILITY_RANGE, std::min(difference, MOBILITY_RANGE));
+}
+
+int EvaluatePatterns(const Board &board) {
+    const PositionState &state = State(board);
+    int features[NUM_FEATURES];
+    EvaluationFeatures(state.patterns, state.mobility, Index(board.next_player), &features);
+    const int16_t *weights = pattern_weights + Phase(board.moves_played)*PHASE_WEIGHTS;
+    int sum = 0;
+    REP(k, NUM_FEATURES) sum += weights[features[k]];
+    const int value = sum >= 0 ? (sum + EVAL_SCALE/2)/EVAL_SCALE : -((EVAL_SCALE/2 - sum)/EVAL_SCALE);
+    return std::max(MIN_VALUE, std::min(value, MAX_VALUE));
+}
+
+int Evaluate(const Board &board) {
+    if (PATTERNS_SUPPORTED && pattern_weights) return EvaluatePatterns(board);
+    const PositionState &state = State(board);
+    const int i = Index(board.next_player);
+    return state.discs[i] - state.discs[1 - i] +
+        2*(__builtin_popcountll(state.mobility[i]) -
+           __builtin_popcountll(state.mobility[1 - i]));
+}
+
+enum class Bound : unsigned char { NONE = 0, UPPER = 1, LOWER = 2, EXACT = 3 };
+
+const int NO_MOVE = 255;
+
+struct TableEntry {
+    int value;
+    int depth;
+    Bound bound;
+    int move;  // field index, or NO_MOVE
+};
+
+// A table slot stores an entry packed into a single data word, together with
+// the key XOR-ed with that data. Search threads share the table without
+// locking: a slot torn by concurrent writes fails the key check on probing,
+// and is treated as a miss.
+struct TableSlot {
+    std::atomic<uint64_t> check;  // key ^ data
+    std::atomic<uint64_t> data;
+};
+
+// Slots sharing a cache line. Store() replaces the least valuable entry of a
+// bucket when the key is not already present.
+const int BUCKET_SIZE = 4;
+
+struct alignas(64) TableBucket {
+    TableSlot slots[BUCKET_SIZE];
+};
+
+static_assert(sizeof(TableBucket) == 64, "bucket should fill one cache line");
+
+class TranspositionTable {
+public:
+    TranspositionTable() : buckets(nullptr), mask(0), generation(0) {}
+
+    // Returns the size in bytes of the largest table that fits in `bytes`: a
+    // power-of-two number of buckets, and at least one.
+    static size_t SizeFor(size_t bytes) {
+        size_t size = 1;
+        while (2*size*sizeof(TableBucket) <= bytes) size *= 2;
+        return size*sizeof(TableBucket);
+    }
+
+    // Allocates a table of SizeFor(`bytes`) bytes from `arena`. Existing
+    // entries are discarded.
+    void Allocate(Arena *arena, size_t bytes) {
+        const size_t size = SizeFor(bytes);
+        buckets = static_cast<TableBucket*>(arena->Allocate(size, sizeof(TableBucket)));
+        mask = size/sizeof(TableBucket) - 1;
+        Clear();
+    }
+
+    size_t Size() const { return buckets ? (mask + 1)*sizeof(TableBucket) : 0; }
+
+    // Discards all entries.
+    void Clear() {
+        memset(static_cast<void*>(buckets), 0, (mask + 1)*sizeof(TableBucket));
+    }
+
+    // Called before each new search to age the entries of earlier searches.
+    // Must not be called while search threads are running.
+    void NewSearch() { generation = (generation + 1) & 0xff; }
+
+    bool Probe(uint64_t key, TableEntry *entry) const {
+        const TableBucket &bucket = buckets[key & mask];
+        REP(i, BUCKET_SIZE) {
+            const uint64_t data = bucket.slots[i].data.load(std::memory_order_relaxed);
+            const uint64_t check = bucket.slots[i].check.load(std::memory_order_relaxed);
+            if ((check ^ data) == key && UnpackBound(data) != Bound::NONE) {
+                entry->value = static_cast<short>(data & 0xffff);
+                entry->depth = (data >> 16) & 0xff;
+                entry->bound = UnpackBound(data);
+                entry->move = (data >> 32) & 0xff;
+                return true;
+            }
         }
+        return false;
     }
-    int flipping_moves = 0;
-    REP(i, total_moves) {
-        if (HasFlips(fields, p, (*moves)[i].row, (*moves)[i].col)) {
-            (*moves)[flipping_moves++] = (*moves)[i];
+
+    void Store(uint64_t key, int depth, Bound bound, int value, int move) {
+        TableBucket &bucket = buckets[key & mask];
+        TableSlot *slot = &bucket.slots[0];
+        int slot_priority = 1 << 30;
+        REP(i, BUCKET_SIZE) {
+            TableSlot *s = &bucket.slots[i];
+            const uint64_t data = s->data.load(std::memory_order_relaxed);
+            const uint64_t check = s->check.load(std::memory_order_relaxed);
+            if ((check ^ data) == key && UnpackBound(data) != Bound::NONE) {
+                // Keep a deeper result for the same position, unless it's stale.
+                if (int((data >> 16) & 0xff) > depth && UnpackGeneration(data) == generation &&
+                        bound != Bound::EXACT) {
+                    return;
+                }
+                if (move == NO_MOVE) move = (data >> 32) & 0xff;
+                slot = s;
+                break;
+            }
+            const int priority = Priority(data);
+            if (priority < slot_priority) {
+                slot = s;
+                slot_priority = priority;
+            }
         }
+        const uint64_t data =
+            uint64_t(static_cast<unsigned short>(value)) |
+            uint64_t(depth & 0xff) << 16 |
+            uint64_t(bound) << 24 |
+            uint64_t(move & 0xff) << 32 |
+            uint64_t(generation) << 40;
+        slot->check.store(key ^ data, std::memory_order_relaxed);
+        slot->data.store(data, std::memory_order_relaxed);
+    }
+
+private:
+    TranspositionTable(const TranspositionTable&) = delete;
+    void operator=(const TranspositionTable&) = delete;
+
+    static Bound UnpackBound(uint64_t data) {
+        return static_cast<Bound>((data >> 24) & 3);
+    }
+
+    static int UnpackGeneration(uint64_t data) {
+        return (data >> 40) & 0xff;
+    }
+
+    // Entries with lower priority are replaced first: empty entries, then
+    // entries from earlier searches, then shallow entries.
+    int Priority(uint64_t data) const {
+        if (UnpackBound(data) == Bound::NONE) return -1;
+        return ((data >> 16) & 0xff) + (UnpackGeneration(data) == generation ? 256 : 0);
     }
-    return flipping_moves > 0 ? flipping_moves : total_moves;
+
+    TableBucket *buckets;
+    size_t mask;
+    int generation;
+};
+
+TranspositionTable transpositions;
+
+// State of a search thread that would otherwise be on the stack of every
+// Search() frame: the board it searches, and the moves of each node on the
+// current path.
+struct SearchStack {
+    Board board;
+    Move moves[MAX_MOVES + 1][MAX_MOVES];  // indexed by moves_played
+};
+
+// One stack per search thread, allocated from search_arena, and the current
+// thread's.
+SearchStack *search_stacks = nullptr;
+int num_search_stacks = 0;
+thread_local SearchStack *search_stack = nullptr;
+
+double GetTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
 }
 
-int Evaluate(const Board &board) {
-    const Player (&fields)[H][W] = board.fields;
-    const Player p = board.next_player;
-    const Player q = Other(p);;
-    int score = 0;
-    REP(r, H) REP(c, W) {
-        if (fields[r][c] == Player::NONE) {
-            if (HasOccupiedNeighbor(fields, r, c)) {
-                if (HasFlips(fields, p, r, c)) score += 2;
-                if (HasFlips(fields, q, r, c)) score -= 2;
+// Per-move search state, shared by all search threads. `search_aborted` is
+// set once the deadline has passed or the main thread has finished, after
+// which all search results are meaningless.
+double search_start_time = 0;
+double search_time_budget = 0;
+double search_deadline = 0;
+std::atomic<bool> search_aborted(false);
+std::atomic<long long> search_total_nodes(0);
+
+// Positions visited by the current search thread, leaves included.
+thread_local long long search_nodes = 0;
+
+// Search events counted with STAT() by the current thread, and the totals of
+// all threads for the current search.
+struct SearchStats {
+    long long leaves = 0;      // evaluated or final positions
+    long long tt_probes = 0;
+    long long tt_hits = 0;
+    long long tt_cutoffs = 0;  // hits that ended the search of a node
+
+    void operator+=(const SearchStats &other) {
+        leaves += other.leaves;
+        tt_probes += other.tt_probes;
+        tt_hits += other.tt_hits;
+        tt_cutoffs += other.tt_cutoffs;
+    }
+};
+thread_local SearchStats search_stats;
+std::mutex search_total_stats_mutex;
+SearchStats search_total_stats;
+
+bool SearchAborted() {
+    if ((++search_nodes & 1023) == 0 && GetTime() > search_deadline) {
+        search_aborted = true;
+    }
+    return search_aborted;
+}
+
+// Final score of a full board from the perspective of the next player. This
+// corresponds with CalculateScore() in the arbiter.
+int FinalScore(const Board &board) {
+    const int i = Index(board.next_player);
+    return State(board).discs[i] - State(board).discs[1 - i];
+}
+
+// Empty fields of the root position, in static order of preference: corners
+// (which can never be flipped) first, then edges, then interior fields, and
+// fields diagonally adjacent to a corner last.
+int solve_fields[H*W];
+int solve_num_fields = 0;
+
+int FieldPriority(int r, int c) {
+    const bool edge_r = r == 0 || r == H - 1;
+    const bool edge_c = c == 0 || c == W - 1;
+    if (edge_r && edge_c) return 0;
+    if ((r == 1 || r == H - 2) && (c == 1 || c == W - 2)) return 3;
+    return edge_r || edge_c ? 1 : 2;
+}
+
+void PrepareSolve(const Board &board) {
+    solve_num_fields = 0;
+    REP(priority, 4) {
+        REP(r, H) REP(c, W) {
+            if (FieldPriority(r, c) == priority && !(Occupied(board) & Bit(r, c))) {
+                solve_fields[solve_num_fields++] = r*W + c;
             }
+        }
+    }
+}
+
+// Returns the union of the board quadrants that contain an odd number of
+// fields in `empty`.
+Bitboard OddQuadrants(Bitboard empty) {
+    Bitboard result = 0;
+    REP(i, 2) REP(j, 2) {
+        Bitboard quadrant = 0;
+        FOR(r, i*H/2, (i + 1)*H/2) FOR(c, j*W/2, (j + 1)*W/2) quadrant |= Bit(r, c);
+        if (__builtin_popcountll(empty & quadrant) & 1) result |= quadrant;
+    }
+    return result;
+}
+
+// Below this number of empty fields, the solver doesn't use the transposition
+// table.
+const int SOLVE_TABLE_EMPTIES = 7;
+
+// From this number of empty fields, the solver orders moves fastest-first
+// (i.e., by increasing opponent's mobility) instead of by parity only.
+const int SOLVE_SORT_EMPTIES = 8;
+
+// Exact end-game solver: searches the remaining `empties` moves and returns
+// the final score (see FinalScore()). Moves are ordered by quadrant parity
+// over solve_fields (which must include all empty fields; see PrepareSolve),
+// and fastest-first when many fields are empty.
+int Solve(Board *board, int empties, int alpha, int beta) {
+    if (empties == 0) {
+        ++search_nodes;
+        STAT(leaves);
+        return FinalScore(*board);
+    }
+    if (SearchAborted()) return 0;
+    const Bitboard valid = ValidMoves(*board);
+    if (empties == 1) {
+        // Score the last move directly, since DoMove() would needlessly
+        // compute the evaluation terms of the final position.
+        ++search_nodes;
+        STAT(leaves);
+        const int i = Index(board->next_player);
+        const Bitboard own = board->pieces[i];
+        const Bitboard opp = board->pieces[1 - i];
+        const Bitboard flips = Flips(own, own | opp, valid);
+        return __builtin_popcountll((own ^ flips) | valid) - __builtin_popcountll(opp ^ flips);
+    }
+    const int original_alpha = alpha;
+    int best_field = NO_MOVE;
+    if (empties >= SOLVE_TABLE_EMPTIES) {
+        TableEntry entry;
+        STAT(tt_probes);
+        if (transpositions.Probe(board->hash, &entry)) {
+            STAT(tt_hits);
+            if (entry.depth >= empties) {
+                const int value = entry.value;
+                if (entry.bound == Bound::LOWER && value > alpha) alpha = value;
+                if (entry.bound == Bound::UPPER && value < beta) beta = value;
+                if (entry.bound == Bound::EXACT || alpha >= beta) {
+                    STAT(tt_cutoffs);
+                    return value;
+                }
+            }
+            best_field = entry.move;
+        }
+    }
+    Move (&moves)[MAX_MOVES] = search_stack->moves[board->moves_played];
+    int num_moves = 0;
+    const Bitboard odd = OddQuadrants(ALL_FIELDS & ~Occupied(*board));
+    REP(pass, 2) {
+        const Bitboard mask = valid & (pass == 0 ? odd : ~odd);
+        REP(i, solve_num_fields) {
+            if (mask & (Bitboard(1) << solve_fields[i])) {
+                moves[num_moves++] = FieldMove(solve_fields[i]);
+            }
+        }
+    }
+    CHECK_EQ(num_moves, __builtin_popcountll(valid));
+    if (empties >= SOLVE_SORT_EMPTIES) {
+        int mobility[MAX_MOVES];
+        REP(i, num_moves) {
+            DoMove(board, moves[i]);
+            mobility[i] = __builtin_popcountll(State(*board).mobility[Index(board->next_player)]);
+            UndoMove(board, moves[i]);
+        }
+        // Insertion sort, which keeps the parity order between equal moves.
+        FOR(i, 1, num_moves) {
+            for (int j = i; j > 0 && mobility[j - 1] > mobility[j]; --j) {
+                std::swap(mobility[j - 1], mobility[j]);
+                std::swap(moves[j - 1], moves[j]);
+            }
+        }
+    }
+    if (best_field != NO_MOVE) {
+        REP(i, num_moves) {
+            if (FieldIndex(moves[i]) == best_field) {
+                std::rotate(&moves[0], &moves[i], &moves[i + 1]);
+                break;
+            }
+        }
+    }
+    int best_value = MIN_VALUE - 1;
+    REP(i, num_moves) {
+        Move move = moves[i];
+        DoMove(board, move);
+        int value;
+        if (i == 0) {
+            value = -Solve(board, empties - 1, -beta, -alpha);
         } else {
-            score += (fields[r][c] == p) ? +1 : -1;
+            value = -Solve(board, empties - 1, -alpha - 1, -alpha);
+            if (value > alpha && value < beta) {
+                value = -Solve(board, empties - 1, -beta, -alpha);
+            }
+        }
+        UndoMove(board, move);
+        if (search_aborted) return 0;
+        if (value > best_value) {
+            best_value = value;
+            best_field = FieldIndex(move);
+            if (value > alpha) alpha = value;
+            if (alpha >= beta) break;
         }
     }
-    return score;
+    if (empties >= SOLVE_TABLE_EMPTIES) {
+        const Bound bound =
+            best_value <= original_alpha ? Bound::UPPER :
+            best_value >= beta ? Bound::LOWER : Bound::EXACT;
+        transpositions.Store(board->hash, empties, bound, best_value, best_field);
+    }
+    return best_value;
+}
+
+// Move ordering heuristics of a search thread, used by Search(): the two
+// most recent killer moves per ply (fields that caused a cutoff at that ply),
+// and per player a history score per field (the sum of the squared depths of
+// the cutoffs it caused).
+struct MoveOrdering {
+    MoveOrdering() {
+        REP(ply, MAX_MOVES) REP(i, 2) killers[ply][i] = NO_MOVE;
+        REP(i, 2) REP(field, H*W) history[i][field] = 0;
+    }
+
+    // Halves all history scores, so that those of earlier searches fade.
+    void Age() {
+        REP(i, 2) REP(field, H*W) history[i][field] /= 2;
+    }
+
+    int killers[MAX_MOVES][2];  // indexed by moves_played
+    int history[2][H*W];        // indexed by Index(player) and field
+};
+
+thread_local MoveOrdering move_ordering;
+
+// History scores are aged early once one reaches this limit, to keep them in
+// range of OrderMoves()'s scores.
+const int HISTORY_LIMIT = 1 << 20;
+
+// Sorts moves in order of search: the field in `best_field` (the transposition
+// table's best move) first, then the killer moves, then by decreasing history
+// score. Ties are broken by field type (see FieldPriority()).
+void OrderMoves(const Board &board, int best_field, Move *moves, int num_moves) {
+    const MoveOrdering &ordering = move_ordering;
+    const int *killers = ordering.killers[board.moves_played];
+    const int *history = ordering.history[Index(board.next_player)];
+    int scores[MAX_MOVES];
+    REP(i, num_moves) {
+        const int field = FieldIndex(moves[i]);
+        scores[i] =
+            field == best_field ? 3 << 28 :
+            field == killers[0] ? 2 << 28 :
+            field == killers[1] ? 1 << 28 :
+            4*history[field] + 3 - FieldPriority(moves[i].row, moves[i].col);
+    }
+    FOR(i, 1, num_moves) {
+        for (int j = i; j > 0 && scores[j - 1] < scores[j]; --j) {
+            std::swap(scores[j - 1], scores[j]);
+            std::swap(moves[j - 1], moves[j]);
+        }
+    }
+}
+
+// From this remaining depth, Search() orders moves with OrderMoves(). Closer
+// to the leaves, sorting costs more than it saves, and only the best move from
+// the transposition table is searched first.
+const int ORDER_MOVES_DEPTH = 3;
+
+// Updates the move ordering heuristics after `field` caused a cutoff.
+void RecordCutoff(const Board &board, int field, int depth) {
+    MoveOrdering &ordering = move_ordering;
+    int *killers = ordering.killers[board.moves_played];
+    if (killers[0] != field) {
+        killers[1] = killers[0];
+        killers[0] = field;
+    }
+    int &history = ordering.history[Index(board.next_player)][field];
+    history += depth*depth;
+    if (history >= HISTORY_LIMIT) ordering.Age();
 }
 
-int Search(Board *board, int depth) {
+// Principal variation search with a fail-soft alpha-beta window. Switches to
+// the end-game solver when the search would reach the end of the game anyway.
+int Search(Board *board, int depth, int alpha, int beta) {
     if (depth <= 0) {
+        ++search_nodes;
+        STAT(leaves);
         return Evaluate(*board);
     }
-    Move moves[MAX_MOVES];
+    const int empties = Empties(*board);
+    if (depth >= empties) {
+        return Solve(board, empties, alpha, beta);
+    }
+    if (SearchAborted()) return 0;
+    const int original_alpha = alpha;
+    int best_field = NO_MOVE;
+    TableEntry entry;
+    STAT(tt_probes);
+    if (transpositions.Probe(board->hash, &entry)) {
+        STAT(tt_hits);
+        if (entry.depth >= depth) {
+            const int value = entry.value;
+            if (entry.bound == Bound::LOWER && value > alpha) alpha = value;
+            if (entry.bound == Bound::UPPER && value < beta) beta = value;
+            if (entry.bound == Bound::EXACT || alpha >= beta) {
+                STAT(tt_cutoffs);
+                return value;
+            }
+        }
+        best_field = entry.move;
+    }
+    Move (&moves)[MAX_MOVES] = search_stack->moves[board->moves_played];
     int num_moves = ListMoves(*board, &moves);
-    if (num_moves <= 0) {
-        // TODO: special end-game evaluation.
-        return Evaluate(*board);
+    if (depth >= ORDER_MOVES_DEPTH) {
+        OrderMoves(*board, best_field, moves, num_moves);
+    } else if (best_field != NO_MOVE) {
+        // Search the best move from the transposition table first.
+        REP(i, num_moves) {
+            if (FieldIndex(moves[i]) == best_field) {
+                std::rotate(&moves[0], &moves[i], &moves[i + 1]);
+                break;
+            }
+        }
     }
     int best_value = MIN_VALUE - 1;
     REP(i, num_moves) {
         Move move = moves[i];
         DoMove(board, move);
-        int value = -Search(board, depth - 1);
+        int value;
+        if (i == 0) {
+            value = -Search(board, depth - 1, -beta, -alpha);
+        } else {
+            value = -Search(board, depth - 1, -alpha - 1, -alpha);
+            if (value > alpha && value < beta) {
+                value = -Search(board, depth - 1, -beta, -alpha);
+            }
+        }
         UndoMove(board, move);
-        if (value > best_value) best_value = value;
+        if (search_aborted) return 0;
+        if (value > best_value) {
+            best_value = value;
+            best_field = FieldIndex(move);
+            if (value > alpha) alpha = value;
+            if (alpha >= beta) {
+                RecordCutoff(*board, best_field, depth);
+                break;
+            }
+        }
     }
     CHECK(best_value >= MIN_VALUE);
     CHECK(best_value <= MAX_VALUE);
+    const Bound bound =
+        best_value <= original_alpha ? Bound::UPPER :
+        best_value >= beta ? Bound::LOWER : Bound::EXACT;
+    transpositions.Store(board->hash, depth, bound, best_value, best_field);
     return best_value;
 }
 
-bool SelectMove(const Board &original_board, Move *best_move) {
-    Board board = original_board;
-    Move moves[MAX_MOVES];
-    int num_moves = ListMoves(board, &moves);
-    std::random_shuffle(&moves[0], &moves[num_moves]);
+// Searches the root moves with the given window, and moves the best move to
+// the front of the list.
+int SearchRoot(Board *board, Move (&moves)[MAX_MOVES], int num_moves,
+        int depth, int alpha, int beta) {
     int best_value = MIN_VALUE - 1;
     REP(i, num_moves) {
         Move move = moves[i];
-        DoMove(&board, move);
-        int value = -Search(&board, 3);
-        UndoMove(&board, move);
+        DoMove(board, move);
+        int value;
+        if (i == 0) {
+            value = -Search(board, depth - 1, -beta, -alpha);
+        } else {
+            value = -Search(board, depth - 1, -alpha - 1, -alpha);
+            if (value > alpha && value < beta) {
+                value = -Search(board, depth - 1, -beta, -alpha);
+            }
+        }
+        UndoMove(board, move);
+        if (search_aborted) break;
         if (value > best_value) {
             best_value = value;
-            *best_move = move;
+            std::rotate(&moves[0], &moves[i], &moves[i + 1]);
+            if (value > alpha) alpha = value;
+            if (alpha >= beta) break;
+        }
+    }
+    return best_value;
+}
+
+const int ASPIRATION_WINDOW = 4;
+
+// Maximum number of empty fields for which the end-game is solved exactly.
+const int DEFAULT_SOLVE_EMPTIES = 16;
+int solve_empties = DEFAULT_SOLVE_EMPTIES;
+
+// Minimum depth of the heuristic search that precedes the exact end-game
+// search. It orders the root moves, and provides a fallback move in case the
+// exact search runs out of time.
+const int SOLVE_PRESEARCH_DEPTH = 4;
+
+// Number of threads searching in parallel. Helper threads run the same
+// iterative deepening as the main thread (with staggered depths and root move
+// orders) and share results through the transposition table only.
+int search_threads = 1;
+
+struct SearchResult {
+    Move move;
+    int value;
+    int depth;  // depth of the last completed iteration
+};
+
+// Iterative deepening on a single thread. For the main thread (index 0), no
+// new iteration is started once half of the time budget has been used; helper
+// threads continue until the search is aborted. In the end-game, the
+// deepening skips ahead to an exact search after spending 1/8th of the budget
+// on heuristic search.
+void IterativeDeepening(const Board &original_board, const Move *root_moves, int num_moves,
+        int thread_index, SearchResult *result) {
+    const double start_time = search_start_time;
+    const double time_budget = search_time_budget;
+    search_nodes = 0;
+    search_stats = SearchStats();
+    move_ordering.Age();
+    CHECK(thread_index < num_search_stacks);
+    search_stack = &search_stacks[thread_index];
+    Board &board = search_stack->board;
+    board = original_board;
+    Move (&moves)[MAX_MOVES] = search_stack->moves[board.moves_played];
+    std::copy(root_moves, root_moves + num_moves, moves);
+    std::rotate(&moves[0], &moves[thread_index % num_moves], &moves[num_moves]);
+    const int max_depth = Empties(board);
+    int best_value = 0;
+    int depth = 0;
+    while (depth < max_depth &&
+            (thread_index > 0 || GetTime() - start_time < time_budget/2)) {
+        int next_depth = std::min(depth + 1 + (thread_index & 1), max_depth);
+        if (max_depth <= solve_empties && depth >= SOLVE_PRESEARCH_DEPTH &&
+                GetTime() - start_time >= time_budget/8) {
+            next_depth = max_depth;
+        }
+        int alpha = MIN_VALUE - 1;
+        int beta = MAX_VALUE + 1;
+        if (depth > 0 && next_depth < max_depth) {
+            alpha = best_value - ASPIRATION_WINDOW;
+            beta = best_value + ASPIRATION_WINDOW;
         }
+        int value;
+        for (;;) {
+            value = SearchRoot(&board, moves, num_moves, next_depth, alpha, beta);
+            if (search_aborted) break;
+            if (value <= alpha) {
+                alpha = MIN_VALUE - 1;
+            } else if (value >= beta) {
+                beta = MAX_VALUE + 1;
+            } else {
+                break;
+            }
+        }
+        if (search_aborted) break;
+        best_value = value;
+        depth = next_depth;
+    }
+    result->move = moves[0];
+    result->value = best_value;
+    result->depth = depth;
+    search_total_nodes += search_nodes;
+    {
+        std::lock_guard<std::mutex> lock(search_total_stats_mutex);
+        search_total_stats += search_stats;
     }
-    std::cerr << "best_value=" << best_value << '\n';
     CHECK(board == original_board);
-    return best_value >= MIN_VALUE;
 }
 
-bool MoveIsValid(const Board &board, const Move &move) {
+// Resets the shared search state for a new search. Must be called before the
+// search threads are started.
+void PrepareSearch(double time_budget) {
+    search_start_time = GetTime();
+    search_time_budget = time_budget;
+    search_deadline = search_start_time + time_budget;
+    search_aborted = false;
+    search_total_nodes = 0;
+    search_total_stats = SearchStats();
+    transpositions.NewSearch();
+}
+
+// Searches with `search_threads` threads, after PrepareSearch(). The final
+// iterations are aborted when the time budget runs out, or when the search is
+// aborted from another thread. The result of the main thread is used, unless
+// a helper thread completed a deeper iteration.
+bool SearchMove(const Board &board, SearchResult *best_result) {
     Move moves[MAX_MOVES];
     int num_moves = ListMoves(board, &moves);
-    REP(i, num_moves) {
-        if (moves[i] == move) return true;
+    if (num_moves <= 0) return false;
+    std::random_shuffle(&moves[0], &moves[num_moves]);
+    PrepareSolve(board);
+    std::vector<SearchResult> results(search_threads);
+    std::vector<std::thread> helpers;
+    FOR(i, 1, search_threads) {
+        helpers.emplace_back(IterativeDeepening, std::cref(board), moves, num_moves, i, &results[i]);
+    }
+    IterativeDeepening(board, moves, num_moves, 0, &results[0]);
+    search_aborted = true;
+    for (std::thread &thread : helpers) thread.join();
+    const SearchResult *best = &results[0];
+    for (const SearchResult &result : results) {
+        if (result.depth > best->depth) best = &result;
+    }
+    *best_result = *best;
+    return true;
+}
+
+// Returns up to `max_length` moves of the principal variation: `move`, then
+// the best moves stored in the transposition table.
+std::vector<Move> PrincipalVariation(Board board, Move move, int max_length) {
+    std::vector<Move> pv;
+    while (int(pv.size()) < max_length) {
+        pv.push_back(move);
+        DoMove(&board, move);
+        TableEntry entry;
+        if (!transpositions.Probe(board.hash, &entry) || entry.move == NO_MOVE) break;
+        move = FieldMove(entry.move);
+        if ((ValidMoves(board) & Bit(move)) == 0) break;
+    }
+    return pv;
+}
+
+// Logs statistics about the search that just finished with `result` on
+// `board`, as a JSON object on a single line. `type` is "move" or "ponder".
+// The counts of leaves and table probes are only included when SEARCH_STATS
+// is enabled.
+void LogSearch(const char *type, const Board &board, const SearchResult &result) {
+    const double time = GetTime() - search_start_time;
+    const long long nodes = search_total_nodes;
+    std::ostringstream os;
+    os << "{\"type\":\"" << type << "\",\"value\":" << result.value
+        << ",\"depth\":" << result.depth << ",\"nodes\":" << nodes
+        << ",\"nps\":" << (time > 0 ? nodes/time : 0.0)
+        << ",\"ebf\":" << (result.depth > 0 ? pow(double(nodes), 1.0/result.depth) : 0.0)
+        << ",\"time\":" << time;
+#if SEARCH_STATS
+    const SearchStats &stats = search_total_stats;
+    const double probes = std::max(stats.tt_probes, 1LL);
+    os << ",\"leaves\":" << stats.leaves << ",\"tt_probes\":" << stats.tt_probes
+        << ",\"tt_hit_rate\":" << stats.tt_hits/probes
+        << ",\"tt_cutoff_rate\":" << stats.tt_cutoffs/probes;
+#endif
+    os << ",\"pv\":[";
+    const std::vector<Move> pv =
+        PrincipalVariation(board, result.move, std::max(result.depth, 1));
+    REP(i, pv.size()) os << (i > 0 ? "," : "") << '"' << FormatMove(pv[i]) << '"';
+    os << "]}\n";
+    *log_stream << os.str();
+}
+
+bool SelectMove(const Board &board, double time_budget, Move *best_move) {
+    PrepareSearch(time_budget);
+    SearchResult result;
+    if (!SearchMove(board, &result)) return false;
+    *best_move = result.move;
+    LogSearch("move", board, result);
+    return true;
+}
+
+// Searches the position on a background thread while the opponent is
+// thinking, until Stop() is called. The results are kept in the transposition
+// table, where the next SelectMove() will find them.
+class Ponderer {
+public:
+    ~Ponderer() { Stop(); }
+
+    void Start(const Board &board) {
+        Stop();
+        this->board = board;
+        PrepareSearch(1e9);
+        thread = std::thread([this]() { searched = SearchMove(this->board, &result); });
+    }
+
+    void Stop() {
+        if (!thread.joinable()) return;
+        search_aborted = true;
+        thread.join();
+        if (searched) LogSearch("ponder", board, result);
+    }
+
+private:
+    Board board;
+    std::thread thread;
+    bool searched = false;
+    SearchResult result;
+};
+
+// Time kept in reserve to account for overhead outside the search.
+const double TIME_RESERVE = 0.5;
+
+// Returns the time budget for the next move, given the time left on the game
+// clock and the number of moves the player still has to make.
+double TimeBudget(double time_left, int moves_left) {
+    time_left -= TIME_RESERVE;
+    if (time_left <= 0) return 0;
+    return std::min(time_left/2, 2*time_left/(moves_left + 1));
+}
+
+bool MoveIsValid(const Board &board, const Move &move) {
+    return (ValidMoves(board) & Bit(move)) != 0;
+}
+
+// An opening book file is a BookHeader followed by BookEntry records sorted by
+// key, in native byte order. Positions are keyed by CanonicalKey(), so one
+// entry covers all symmetric positions. The file is memory-mapped, so opening
+// it costs no parsing, and a lookup is a binary search.
+const char BOOK_MAGIC[8] = {'F', 'L', 'I', 'P', 'B', 'O', 'O', 'K'};
+const uint32_t BOOK_VERSION = 1;
+
+struct BookHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;  // sizeof(BookEntry)
+    uint64_t num_entries;
+};
+
+struct BookEntry {
+    uint64_t key;    // CanonicalKey() of the position
+    int16_t value;   // for the player to move
+    uint8_t depth;   // of the search that found the move
+    uint8_t field;   // the best move, in the canonical orientation
+    uint32_t unused;
+};
+
+static_assert(sizeof(BookHeader) == 24 && sizeof(BookEntry) == 16, "book format changed");
+
+class OpeningBook {
+public:
+    bool IsOpen() const { return file.IsOpen(); }
+
+    // Maps the book file into memory. Returns false, after logging the reason,
+    // if it can't be read or isn't a valid book.
+    bool Open(const char *path) {
+        Close();
+        if (!file.Open(path)) return false;
+        const BookHeader *header = static_cast<const BookHeader*>(file.Data());
+        if (file.Size() >= sizeof(BookHeader) &&
+                memcmp(header->magic, BOOK_MAGIC, sizeof(BOOK_MAGIC)) == 0 &&
+                header->version == BOOK_VERSION && header->entry_size == sizeof(BookEntry) &&
+                header->num_entries == (file.Size() - sizeof(BookHeader))/sizeof(BookEntry)) {
+            entries = reinterpret_cast<const BookEntry*>(header + 1);
+            num_entries = header->num_entries;
+            return true;
+        }
+        file.Close();
+        std::cerr << "Invalid book [" << path << "]\n";
+        return false;
+    }
+
+    void Close() {
+        file.Close();
+        entries = nullptr;
+        num_entries = 0;
+    }
+
+    const BookEntry *begin() const { return entries; }
+    const BookEntry *end() const { return entries + num_entries; }
+
+    // Returns the entry for the board's position and sets `*move` to its
+    // move, or returns nullptr if the position isn't in the book.
+    const BookEntry *Lookup(const Board &board, Move *move) const {
+        int symmetry;
+        const uint64_t key = CanonicalKey(board.pieces, &symmetry);
+        const BookEntry *entry = std::lower_bound(begin(), end(), key,
+            [](const BookEntry &e, uint64_t key) { return e.key < key; });
+        if (entry == end() || entry->key != key || entry->field >= H*W) return nullptr;
+        *move = FieldMove(InverseTransformField(symmetry, entry->field));
+        return entry;
+    }
+
+private:
+    MappedFile file;
+    const BookEntry *entries = nullptr;
+    size_t num_entries = 0;
+};
+
+OpeningBook opening_book;
+
+bool WriteBook(const std::map<uint64_t, BookEntry> &entries, const std::string &path) {
+    BookHeader header;
+    memcpy(header.magic, BOOK_MAGIC, sizeof(BOOK_MAGIC));
+    header.version = BOOK_VERSION;
+    header.entry_size = sizeof(BookEntry);
+    header.num_entries = entries.size();
+    const std::string temp_path = path + ".tmp";
+    std::ofstream ofs(temp_path, std::ios::binary);
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const auto &e : entries) {
+        ofs.write(reinterpret_cast<const char*>(&e.second), sizeof(e.second));
+    }
+    ofs.close();
+    if (!ofs || rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "Cannot write book [" << path << "]\n";
+        return false;
+    }
+    return true;
+}
+
+// Builds an opening book with an entry for every position in the first
+// `plies` moves of the game, found with a search of `time_per_position`
+// seconds. Positions that are already in an existing book at `path` are kept
+// and not searched again, so a book can be grown over several runs by raising
+// `plies`. The book is saved periodically, so an interrupted run loses little.
+class BookBuilder {
+public:
+    BookBuilder(const std::string &path, int plies, double time_per_position)
+        : path(path), plies(plies), time_per_position(time_per_position) {}
+
+    bool Build() {
+        if (access(path.c_str(), F_OK) == 0) {
+            if (!opening_book.Open(path.c_str())) return false;
+            for (const BookEntry &entry : opening_book) entries[entry.key] = entry;
+            opening_book.Close();
+        }
+        std::cerr << "book_entries=" << entries.size() << '\n';
+        Board board = InitialBoard();
+        Expand(&board);
+        return WriteBook(entries, path);
+    }
+
+private:
+    void Expand(Board *board) {
+        if (board->moves_played >= plies) return;
+        int symmetry;
+        const uint64_t key = CanonicalKey(board->pieces, &symmetry);
+        if (!visited.insert(key).second) return;
+        if (entries.count(key) == 0) {
+            PrepareSearch(time_per_position);
+            SearchResult result;
+            if (!SearchMove(*board, &result)) return;
+            LogSearch("book", *board, result);
+            BookEntry &entry = entries[key];
+            entry.key = key;
+            entry.value = result.value;
+            entry.depth = std::min(result.depth, 255);
+            entry.field = TransformField(symmetry, FieldIndex(result.move));
+            entry.unused = 0;
+            if (++searched % SAVE_INTERVAL == 0) WriteBook(entries, path);
+        }
+        Move moves[MAX_MOVES];
+        const int num_moves = ListMoves(*board, &moves);
+        REP(i, num_moves) {
+            DoMove(board, moves[i]);
+            Expand(board);
+            UndoMove(board, moves[i]);
+        }
+    }
+
+    // Positions searched between saves of the book.
+    static const int SAVE_INTERVAL = 100;
+
+    const std::string path;
+    const int plies;
+    const double time_per_position;
+    std::map<uint64_t, BookEntry> entries;
+    std::set<uint64_t> visited;
+    int searched = 0;
+};
+
+struct Options {
+    double time_limit = 30.0;  // seconds per game
+    int hash_size = 16;        // MiB
+    int memory_limit = 0;      // MiB for all of the search's memory, or 0 for no limit
+    bool large_pages = false;  // back the search's memory with huge pages
+    bool ponder = false;
+    std::string book_path;     // opening book file, if any
+    std::string weights_path;  // pattern evaluation weights file, if any
+};
+
+const char *const USAGE =
+    "Usage: player [--time=<seconds per game>] [--hash=<MiB>] "
+    "[--solve=<empty fields>] [--threads=<N>] [--ponder] [--book=<file>] "
+    "[--weights=<file>] [--memory=<MiB>] [--large-pages]\n"
+    "       player --build-book=<file> [--book-plies=<N>] [--book-time=<seconds per position>] "
+    "[--hash=<MiB>] [--solve=<empty fields>] [--threads=<N>] [--weights=<file>]\n";
+
+// Parses a single command line argument into `options`, or into the global
+// search parameters. Returns false if the argument isn't recognized.
+bool ParseOption(const char *arg, Options *options) {
+    if (sscanf(arg, "--time=%lf", &options->time_limit) == 1) return true;
+    if (sscanf(arg, "--hash=%d", &options->hash_size) == 1 && options->hash_size > 0) return true;
+    if (sscanf(arg, "--solve=%d", &solve_empties) == 1) return true;
+    if (sscanf(arg, "--threads=%d", &search_threads) == 1 && search_threads > 0) return true;
+    if (sscanf(arg, "--memory=%d", &options->memory_limit) == 1 && options->memory_limit > 0) {
+        return true;
+    }
+    if (strcmp(arg, "--ponder") == 0) {
+        options->ponder = true;
+        return true;
+    }
+    if (strcmp(arg, "--large-pages") == 0) {
+        options->large_pages = true;
+        return true;
+    }
+    if (strncmp(arg, "--book=", 7) == 0) {
+        options->book_path = arg + 7;
+        return true;
+    }
+    if (strncmp(arg, "--weights=", 10) == 0) {
+        options->weights_path = arg + 10;
+        return true;
     }
     return false;
 }
 
-std::string FormatMove(const Move &move) {
-    std::string s;
-    s.reserve(2);
-    s += char('A' + move.row);
-    s += char('1' + move.col);
-    return s;
+// Reserves the search's memory: a stack per search thread, and a
+// transposition table of options.hash_size MiB, or smaller if that would
+// exceed options.memory_limit. Returns false, after logging the reason, if the
+// memory can't be reserved. If the memory reserved by an earlier call has the
+// same layout, it is kept, and only the table is cleared: a plugin calls this
+// for every game. Inline, since tune includes player.cc without searching.
+inline bool AllocateSearchMemory(const Options &options) {
+    static bool reserved_large_pages = false;
+    const size_t page_size = options.large_pages ? Arena::LARGE_PAGE_SIZE : 4096;
+    const size_t stacks_size =
+        (search_threads*sizeof(SearchStack) + page_size - 1) & ~(page_size - 1);
+    size_t table_size = size_t(options.hash_size) << 20;
+    if (options.memory_limit > 0) {
+        const size_t limit = size_t(options.memory_limit) << 20;
+        if (limit < stacks_size + sizeof(TableBucket)) {
+            std::cerr << "--memory=" << options.memory_limit << " is too small for "
+                << search_threads << " search threads\n";
+            return false;
+        }
+        table_size = std::min(table_size, limit - stacks_size);
+    }
+    table_size = TranspositionTable::SizeFor(table_size);
+    if (search_arena.Size() > 0 && num_search_stacks == search_threads &&
+            transpositions.Size() == table_size && reserved_large_pages == options.large_pages) {
+        transpositions.Clear();
+    } else {
+        if (!search_arena.Reserve(stacks_size + table_size, options.large_pages)) return false;
+        reserved_large_pages = options.large_pages;
+        search_stacks = static_cast<SearchStack*>(search_arena.Allocate(stacks_size, page_size));
+        REP(i, search_threads) new (&search_stacks[i]) SearchStack;
+        num_search_stacks = search_threads;
+        transpositions.Allocate(&search_arena, table_size);
+    }
+    *log_stream << "search_memory=" << search_arena.Size() << " hash_size=" << table_size
+        << " pages=" << search_arena.PageType() << '\n';
+    return true;
 }
 
-bool ParseMove(const std::string &s, Move *move) {
-    if (s.size() != 2) return false;
-    int row = s[0] - 'A';
-    int col = s[1] - '1';
-    if (!ValidCoords(row, col)) return false;
-    move->row = row;
-    move->col = col;
+// The state of a game in progress: the board, and the time used by our own
+// moves.
+class Game {
+public:
+    explicit Game(const Options &options) : options(options), board(InitialBoard()) {}
+
+    Player NextPlayer() const { return board.next_player; }
+
+    // Selects and plays a move for the next player, from the opening book if
+    // the position is in it, then starts pondering if enabled. Returns false if
+    // there is no move.
+    bool PlayOwnMove(Move *move) {
+        const double start_time = GetTime();
+        const int moves_left = (Empties(board) + 1)/2;
+        if (!PlayBookMove(move) &&
+                !SelectMove(board, TimeBudget(options.time_limit - time_used, moves_left), move)) {
+            return false;
+        }
+        CHECK(MoveIsValid(board, *move));
+        DoMove(&board, *move);
+        time_used += GetTime() - start_time;
+        if (options.ponder && Empties(board) > 0) ponderer.Start(board);
+        return true;
+    }
+
+    // Plays the opponent's move. Returns false if it's invalid.
+    bool PlayOpponentMove(const Move &move) {
+        StopPondering();
+        if (!MoveIsValid(board, move)) return false;
+        DoMove(&board, move);
+        return true;
+    }
+
+    void StopPondering() { ponderer.Stop(); }
+
+private:
+    bool PlayBookMove(Move *move) {
+        const BookEntry *entry = opening_book.Lookup(board, move);
+        if (!entry || !MoveIsValid(board, *move)) return false;
+        *log_stream << "{\"type\":\"book\",\"value\":" << entry->value
+            << ",\"depth\":" << int(entry->depth) << ",\"pv\":[\"" << FormatMove(*move) << "\"]}\n";
+        return true;
+    }
+
+    const Options options;
+    Board board;
+    double time_used = 0;
+    Ponderer ponderer;
+};
+
+}  // namespace
+
+#ifdef FLIPPO_PLUGIN
+
+namespace {
+
+std::ofstream plugin_log;
+
+}  // namespace
+
+int flippo_plugin_version(void) {
+    return FLIPPO_PLUGIN_VERSION;
+}
+
+void *flippo_new_game(const char *args, const char *log_filename) {
+    // A copy of the plugin may play one game after another for players with
+    // different arguments: nothing may carry over from the previous game.
+    solve_empties = DEFAULT_SOLVE_EMPTIES;
+    search_threads = 1;
+    Options options;
+    std::istringstream iss(args);
+    std::string arg;
+    while (iss >> arg) {
+        if (!ParseOption(arg.c_str(), &options)) return nullptr;
+    }
+    static bool seeded = false;
+    if (!seeded) {
+        // Each copy of the plugin has its own globals, but they all share the
+        // process id: mix in an address that differs between copies.
+        rng_seed ^= static_cast<unsigned>(reinterpret_cast<uintptr_t>(&seeded) >> 12);
+        srand(rng_seed);
+        seeded = true;
+    }
+    plugin_log.close();
+    plugin_log.clear();
+    plugin_log.open(log_filename);
+    log_stream = &plugin_log;
+    *log_stream << "rng_seed=" << rng_seed << '\n';
+    // The book and weights files stay mapped for as long as the next game uses
+    // the same ones.
+    static std::string book_path, weights_path;
+    if (options.book_path != book_path) {
+        opening_book.Close();
+        book_path.clear();
+        if (!options.book_path.empty()) {
+            if (!opening_book.Open(options.book_path.c_str())) return nullptr;
+            book_path = options.book_path;
+        }
+    }
+    if (options.weights_path != weights_path) {
+        weights_file.Close();
+        pattern_weights = nullptr;
+        weights_path.clear();
+        if (!options.weights_path.empty()) {
+            if (!LoadWeights(options.weights_path.c_str())) return nullptr;
+            weights_path = options.weights_path;
+        }
+    }
+    if (!AllocateSearchMemory(options)) return nullptr;
+    return new Game(options);
+}
+
+int flippo_opponent_move(void *game, int row, int col) {
+    if (!ValidCoords(row, col)) return 0;
+    return static_cast<Game*>(game)->PlayOpponentMove(Move(row, col));
+}
+
+int flippo_select_move(void *game, int *row, int *col) {
+    Move move;
+    if (!static_cast<Game*>(game)->PlayOwnMove(&move)) return 0;
+    *row = move.row;
+    *col = move.col;
+    return 1;
+}
+
+void flippo_free_game(void *game) {
+    delete static_cast<Game*>(game);
+    plugin_log.flush();
+}
+
+#elif !defined(FLIPPO_NO_MAIN)  // for programs that include player.cc
+
+namespace {
+
+// Points stderr, the player's log, at the file `path` (truncated).
+bool RedirectLog(const std::string &path) {
+    const int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0666);
+    if (fd < 0 || dup2(fd, STDERR_FILENO) < 0) {
+        std::cerr << "Cannot open log [" << path << "]: " << strerror(errno) << '\n';
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    close(fd);
     return true;
 }
 
 }  // namespace
 
 int main(int argc, char *argv[]) {
+    Options options;
+    std::string build_book_path;
+    int book_plies = 6;
+    double book_time = 1.0;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--build-book=", 13) == 0) {
+            build_book_path = argv[i] + 13;
+            continue;
+        }
+        if (sscanf(argv[i], "--book-plies=%d", &book_plies) == 1 && book_plies >= 0) continue;
+        if (sscanf(argv[i], "--book-time=%lf", &book_time) == 1 && book_time > 0) continue;
+        if (!ParseOption(argv[i], &options)) {
+            std::cerr << "Unrecognized argument: [" << argv[i] << "]\n" << USAGE;
+            return 1;
+        }
+    }
+    if (!AllocateSearchMemory(options)) return 1;
+    if (!options.weights_path.empty() && !LoadWeights(options.weights_path.c_str())) return 1;
+    if (!build_book_path.empty()) {
+        srand(rng_seed);
+        return BookBuilder(build_book_path, book_plies, book_time).Build() ? 0 : 1;
+    }
+    if (!options.book_path.empty() && !opening_book.Open(options.book_path.c_str())) return 1;
     std::cerr << "TODO: print player name & version string\n";
     std::cerr << "rng_seed=" << rng_seed << '\n';
+    std::cerr << "move_generation=" << ActiveMoveGeneration().name << '\n';
     srand(rng_seed);
+    // Protocol extensions offered by the arbiter (see ARBITER_FEATURES in
+    // arbiter.cc): "Reset <log file>" between games, and "Opening <moves>"
+    // before them.
+    if (getenv("FLIPPO_ARBITER_FEATURES")) std::cout << "Features reset opening" << std::endl;
     Player my_player = Player::NONE;
-    Board board = InitialBoard();
+    std::unique_ptr<Game> game(new Game(options));
     Move move;
     for (;;) {
-        if (my_player == board.next_player) {
-            if (!SelectMove(board, &move)) {
+        if (my_player == game->NextPlayer()) {
+            if (!game->PlayOwnMove(&move)) {
                 std::cerr << "No move possible. Exiting.\n";
                 return 0;
             }
             std::cout << FormatMove(move) << std::endl;
         } else {
             std::string line;
-            if (!std::getline(std::cin, line)) {
+            bool read = bool(std::getline(std::cin, line));
+            game->StopPondering();
+            if (!read) {
                 std::cerr << "Premature end of input.\n";
                 return 1;
             }
@@ -275,19 +1734,42 @@ int main(int argc, char *argv[]) {
                 std::cerr << "Quit received. Exiting.";
                 return 0;
             }
+            if (line.compare(0, 5, "Reset") == 0 && (line.size() == 5 || line[5] == ' ')) {
+                // "Reset <log file>": the next game's log goes to a file of its own.
+                if (line.size() > 6 && !RedirectLog(line.substr(6))) return 1;
+                std::cerr << "Reset received. Starting a new game.\n";
+                transpositions.Clear();
+                game.reset(new Game(options));
+                my_player = Player::NONE;
+                continue;
+            }
             if (my_player == Player::NONE) {
+                if (line.compare(0, 8, "Opening ") == 0) {
+                    // Moves for both sides, before the player's color is known.
+                    for (size_t i = 8; i + 2 <= line.size(); i += 2) {
+                        if (!ParseMove(line.substr(i, 2), &move) || !game->PlayOpponentMove(move)) {
+                            std::cerr << "Invalid opening received: [" << line << "]\n";
+                            return 1;
+                        }
+                    }
+                    continue;
+                }
                 if (line == "Start") {
-                    my_player = Player::WHITE;
+                    my_player = game->NextPlayer();
                     continue;
                 }
-                my_player = Player::BLACK;
+                my_player = Other(game->NextPlayer());
             }
             if (!ParseMove(line, &move)) {
                 std::cerr << "Invalid move received: [" << line << "]\n";
                 return 1;
             }
+            if (!game->PlayOpponentMove(move)) {
+                std::cerr << "Invalid move received: [" << line << "]\n";
+                return 1;
+            }
         }
-        CHECK(MoveIsValid(board, move));
-        DoMove(&board, move);
     }
 }
+
+#endif  // FLIPPO_PLUGIN
@@ -0,0 +1,171 @@
+// Fits the weights of the player's pattern evaluation (see EvaluatePatterns in
+// player.cc) to the final scores of the games in one or more datasets (see
+// flippo_dataset.h), and writes them as a weights file for --weights. Progress
+// is printed as lines of key=value pairs.
+
+#include <random>
+#include <unordered_map>
+
+#define FLIPPO_NO_MAIN
+#include "player.cc"
+#include "flippo_dataset.h"
+
+namespace {
+
+struct Sample {
+    uint16_t features[NUM_FEATURES];  // offsets into the phase's weights
+    uint8_t phase;
+    int count;                        // number of games the position occurred in
+    float target;                     // mean final score for the player to move
+};
+
+// Adds a sample for each distinct position in the dataset at `path` that isn't
+// in `samples` yet, and adds the final scores of the others to their samples.
+// Equivalent positions share a sample, which is valid because the features
+// don't depend on the orientation (see PatternTables::symmetric_index):
+// `samples_by_key` maps their CanonicalKey() to its index.
+bool ReadSamples(const char *path, std::vector<Sample> *samples,
+        std::unordered_map<uint64_t, size_t> *samples_by_key) {
+    DatasetReader reader;
+    if (!reader.Open(path)) {
+        std::cerr << "Cannot open [" << path << "]\n";
+        return false;
+    }
+    std::vector<DatasetRecord> records;
+    while (reader.NextBlock(&records)) {
+        for (const DatasetRecord &record : records) {
+            // The value of a finished game is exact: there is nothing to fit.
+            if (record.moves_played >= MAX_MOVES) continue;
+            const int i = record.moves_played % 2;
+            const int target = i == 0 ? record.score : -record.score;
+            int symmetry;
+            const auto inserted =
+                samples_by_key->emplace(CanonicalKey(record.pieces, &symmetry), samples->size());
+            if (!inserted.second) {
+                Sample &sample = (*samples)[inserted.first->second];
+                sample.count += 1;
+                sample.target += target;
+                continue;
+            }
+            uint16_t patterns[PATTERN_LANES];
+            Bitboard mobility[2];
+            ComputePatterns(record.pieces, &patterns);
+            FlippingMoves(record.pieces, &mobility);
+            int features[NUM_FEATURES];
+            EvaluationFeatures(patterns, mobility, i, &features);
+            Sample sample;
+            REP(k, NUM_FEATURES) sample.features[k] = features[k];
+            sample.phase = Phase(record.moves_played);
+            sample.count = 1;
+            sample.target = target;
+            samples->push_back(sample);
+        }
+    }
+    if (reader.Error()) {
+        std::cerr << "Ignored " << reader.Remaining() << " bytes at the end of [" << path << "]: "
+            << reader.Error() << '\n';
+    }
+    return true;
+}
+
+bool WriteWeights(const std::vector<float> &weights, const char *path) {
+    WeightsHeader header = {};
+    memcpy(header.magic, WEIGHTS_MAGIC, sizeof(WEIGHTS_MAGIC));
+    header.num_phases = NUM_PHASES;
+    header.phase_weights = PHASE_WEIGHTS;
+    std::vector<int16_t> values(weights.size());
+    REP(k, int(weights.size())) {
+        const long value = lround(weights[k]*EVAL_SCALE);
+        values[k] = std::max<long>(INT16_MIN, std::min<long>(value, INT16_MAX));
+    }
+    std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    ofs.write(reinterpret_cast<const char*>(values.data()), values.size()*sizeof(values[0]));
+    ofs.close();
+    if (!ofs) {
+        std::cerr << "Cannot write [" << path << "]\n";
+        return false;
+    }
+    return true;
+}
+
+// Minimizes the squared error of the evaluation in discs over all positions
+// by stochastic gradient descent, visiting the samples in a new random order
+// every epoch. A sample's step is that of `count` consecutive steps for its
+// position, so frequent positions weigh as much as they would without
+// merging. Starts from the loaded weights, if any.
+void Fit(std::vector<Sample> *samples, int epochs, double rate, std::vector<float> *weights) {
+    weights->assign(NUM_PHASES*PHASE_WEIGHTS, 0.0f);
+    if (pattern_weights) {
+        REP(k, NUM_PHASES*PHASE_WEIGHTS) (*weights)[k] = float(pattern_weights[k])/EVAL_SCALE;
+    }
+    long long positions = 0;
+    for (const Sample &sample : *samples) positions += sample.count;
+    std::mt19937 rng(rng_seed);
+    REP(epoch, epochs) {
+        std::shuffle(samples->begin(), samples->end(), rng);
+        double squared_error = 0;
+        for (const Sample &sample : *samples) {
+            float *w = &(*weights)[sample.phase*PHASE_WEIGHTS];
+            float value = 0;
+            REP(k, NUM_FEATURES) value += w[sample.features[k]];
+            const float error = value - sample.target;
+            squared_error += sample.count*error*error;
+            // A single step removes the fraction `rate` of the error.
+            const float step = (1 - pow(1 - rate, sample.count))*error/NUM_FEATURES;
+            REP(k, NUM_FEATURES) w[sample.features[k]] -= step;
+        }
+        printf("epoch=%d samples=%d rms=%.4f\n", epoch + 1, int(samples->size()),
+            positions == 0 ? 0.0 : sqrt(squared_error/positions));
+        fflush(stdout);
+    }
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    if (!PATTERNS_SUPPORTED) {
+        std::cerr << "The pattern evaluation needs an 8x8 board\n";
+        return 1;
+    }
+    Options options;
+    std::string output = "weights.bin";
+    int epochs = 10;
+    double rate = 0.01;
+    std::vector<const char*> datasets;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--output=", 9) == 0) {
+            output = argv[i] + 9;
+            continue;
+        }
+        if (sscanf(argv[i], "--epochs=%d", &epochs) == 1 && epochs >= 0) continue;
+        if (sscanf(argv[i], "--rate=%lf", &rate) == 1 && rate > 0) continue;
+        if (ParseOption(argv[i], &options)) continue;
+        if (argv[i][0] != '-') {
+            datasets.push_back(argv[i]);
+            continue;
+        }
+        datasets.clear();
+        break;
+    }
+    if (datasets.empty()) {
+        std::cerr << "Usage: tune [--output=<weights file>] [--epochs=<N>] [--rate=<learning rate>] "
+            << "[--weights=<initial weights file>] <dataset>...\n";
+        return 1;
+    }
+    if (!options.weights_path.empty() && !LoadWeights(options.weights_path.c_str())) return 1;
+    std::vector<Sample> samples;
+    std::unordered_map<uint64_t, size_t> samples_by_key;
+    for (const char *path : datasets) {
+        if (!ReadSamples(path, &samples, &samples_by_key)) return 1;
+    }
+    long long positions = 0;
+    for (Sample &sample : samples) {
+        positions += sample.count;
+        sample.target /= sample.count;
+    }
+    printf("positions=%lld unique=%d\n", positions, int(samples.size()));
+    std::vector<float> weights;
+    Fit(&samples, epochs, rate, &weights);
+    return WriteWeights(weights, output.c_str()) ? 0 : 1;
+}
@@ -0,0 +1,435 @@
+// Checks the games recorded in arbiter output or dataset files (see
+// flippo_dataset.h) in bulk: that every move is legal, and that the recorded
+// score is the one the arbiter would compute. Also reports games that
+// duplicate an earlier game, up to a symmetry of the board.
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "flippo_dataset.h"
+#include "flippo_rules.h"
+
+namespace {
+
+using namespace flippo;
+
+double GetMonotonicTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// Number of games read before they are checked in parallel. Bounds the memory
+// used for large files.
+const size_t BATCH_GAMES = 1 << 16;
+
+// A recorded game. `location` identifies it in error messages: the line of
+// arbiter output, or the index of the game in a dataset.
+struct Game {
+  long long location = 0;
+  std::string parse_error;
+  std::vector<Move> moves;
+  int score = 0;
+  std::vector<DatasetRecord> records;  // for games from datasets
+
+  // Results of Check().
+  std::string error;
+  uint64_t key = 0;
+};
+
+// TransformField() of every field, by symmetry.
+struct SymmetricFields {
+  SymmetricFields() {
+    for (int s = 0; s < NUM_SYMMETRIES; ++s) {
+      for (int field = 0; field < H*W; ++field) {
+        fields[s][field] = TransformField(s, field);
+      }
+    }
+  }
+
+  uint8_t fields[NUM_SYMMETRIES][H*W];
+};
+
+const SymmetricFields symmetric_fields;
+
+// Returns a hash of the moves that is the same for games that are equivalent
+// under a symmetry of the board. The images under all symmetries are hashed
+// in a single pass, with independent multiply-add chains that run in
+// parallel.
+uint64_t CanonicalGameKey(const std::vector<Move> &moves) {
+  uint64_t keys[NUM_SYMMETRIES];
+  for (int s = 0; s < NUM_SYMMETRIES; ++s) keys[s] = moves.size();
+  for (const Move &move : moves) {
+    const int field = FieldIndex(move);
+    for (int s = 0; s < NUM_SYMMETRIES; ++s) {
+      keys[s] = keys[s]*0x9e3779b97f4a7c15ull + symmetric_fields.fields[s][field] + 1;
+    }
+  }
+  uint64_t best_key = ~uint64_t(0);
+  for (int s = 0; s < NUM_SYMMETRIES; ++s) best_key = std::min(best_key, Mix64(keys[s]));
+  return best_key;
+}
+
+// Plays `move` if it's valid, like ValidateMove() and ExecuteMove() in the
+// arbiter, but only computes all valid moves if `move` flips nothing.
+bool PlayMove(Position *position, const Move &move) {
+  const int i = NextPlayer(*position);
+  const Bitboard bit = Bit(move);
+  const Bitboard occupied = Occupied(*position);
+  if (occupied & bit) return false;
+  const Bitboard flips = Flips(position->pieces[i], occupied, bit);
+  if (flips == 0 && (ValidMoves(*position) & bit) == 0) return false;
+  position->pieces[i] ^= flips | bit;
+  position->pieces[1 - i] ^= flips;
+  position->moves_played += 1;
+  return true;
+}
+
+// Replays the game, and sets game.error if it isn't valid.
+void Check(Game &game) {
+  game.key = CanonicalGameKey(game.moves);
+  if (!game.parse_error.empty()) {
+    game.error = game.parse_error;
+    return;
+  }
+  Position position = InitialPosition();
+  for (size_t i = 0; i < game.moves.size(); ++i) {
+    if (!game.records.empty()) {
+      const DatasetRecord &record = game.records[i];
+      if (record.pieces[0] != position.pieces[0] || record.pieces[1] != position.pieces[1]) {
+        game.error = "position " + std::to_string(i) + " doesn't match the moves";
+        return;
+      }
+    }
+    const Move &move = game.moves[i];
+    if (IsGameOver(position) || !PlayMove(&position, move)) {
+      game.error = "invalid move " + std::to_string(i + 1) + " (" + FormatMove(move) + ")";
+      return;
+    }
+  }
+  int expected_score;
+  if (IsGameOver(position)) {
+    expected_score = Score(position);
+  } else {
+    // The player to move failed; see RunGame() in arbiter.cc.
+    expected_score = NextPlayer(position) == 0 ? -FAILURE_SCORE : +FAILURE_SCORE;
+  }
+  if (!game.records.empty()) {
+    const DatasetRecord &last = game.records.back();
+    if (!IsGameOver(position)) {
+      game.error = "incomplete game";
+      return;
+    }
+    if (last.pieces[0] != position.pieces[0] || last.pieces[1] != position.pieces[1]) {
+      game.error = "final position doesn't match the moves";
+      return;
+    }
+    for (const DatasetRecord &record : game.records) {
+      if (record.score != game.records[0].score) {
+        game.error = "positions have different final scores";
+        return;
+      }
+    }
+  }
+  if (game.score != expected_score) {
+    game.error = "score " + std::to_string(game.score) + " should be " +
+        std::to_string(expected_score);
+  }
+}
+
+// Parses a game line of arbiter output: "<game>: [<player>-<player> ]<moves>
+// <score>". Returns false for other lines, which don't start with "<game>:".
+bool ParseGameLine(const char *begin, const char *end, Game *game) {
+  const char *p = begin;
+  while (p < end && *p == ' ') ++p;
+  if (p == end || !isdigit(*p)) return false;
+  while (p < end && isdigit(*p)) ++p;
+  if (p == end || *p != ':') return false;
+  ++p;
+  std::vector<std::string> tokens;
+  while (p < end) {
+    while (p < end && isspace(*p)) ++p;
+    const char *q = p;
+    while (q < end && !isspace(*q)) ++q;
+    if (q > p) tokens.emplace_back(p, q);
+    p = q;
+  }
+  char *score_end = nullptr;
+  if (!tokens.empty()) game->score = strtol(tokens.back().c_str(), &score_end, 10);
+  if (tokens.empty() || tokens.size() > 3 || *score_end != '\0') {
+    game->parse_error = "unrecognized game line";
+    return true;
+  }
+  tokens.pop_back();
+  // The moves are missing if the first move failed. With more than two
+  // players, they follow the names of the players.
+  std::string transcript;
+  if (tokens.size() == 2 || (tokens.size() == 1 && tokens[0].find('-') == std::string::npos)) {
+    transcript = tokens.back();
+  }
+  if (transcript.size() % 2 != 0 || int(transcript.size()) > 2*MAX_MOVES) {
+    game->parse_error = "transcript has an invalid length";
+    return true;
+  }
+  game->moves.reserve(transcript.size()/2);
+  for (size_t i = 0; i < transcript.size(); i += 2) {
+    Move move;
+    if (!ParseMove(transcript.substr(i, 2), &move)) {
+      game->parse_error = "cannot parse move " + std::to_string(i/2 + 1) + " (" +
+          transcript.substr(i, 2) + ")";
+      return true;
+    }
+    game->moves.push_back(move);
+  }
+  return true;
+}
+
+// A source of games: arbiter output, or a dataset.
+class GameReader {
+public:
+  virtual ~GameReader() {}
+
+  // Adds up to `max_games` games to `games`. Returns false once there are no
+  // more games.
+  virtual bool Read(size_t max_games, std::vector<Game> *games) = 0;
+};
+
+class TextGameReader : public GameReader {
+public:
+  TextGameReader(const char *data, size_t size) : p(data), end(data + size) {}
+
+  bool Read(size_t max_games, std::vector<Game> *games) override {
+    while (p < end && games->size() < max_games) {
+      const char *eol = static_cast<const char*>(memchr(p, '\n', end - p));
+      if (eol == nullptr) eol = end;
+      ++line;
+      Game game;
+      if (ParseGameLine(p, eol, &game)) {
+        game.location = line;
+        games->push_back(std::move(game));
+      }
+      p = eol < end ? eol + 1 : end;
+    }
+    return p < end;
+  }
+
+private:
+  const char *p;
+  const char *end;
+  long long line = 0;
+};
+
+class DatasetGameReader : public GameReader {
+public:
+  explicit DatasetGameReader(DatasetReader *reader) : reader(reader) {}
+
+  // Games are the runs of records from the initial position to a full board.
+  // Records that don't form a complete game are reported as one.
+  bool Read(size_t max_games, std::vector<Game> *games) override {
+    while (games->size() < max_games) {
+      if (next == block.size()) {
+        next = 0;
+        if (!reader->NextBlock(&block)) {
+          block.clear();
+          if (!current.records.empty()) Finish(games);
+          return false;
+        }
+      }
+      const DatasetRecord &record = block[next++];
+      if (record.moves_played == 0 && !current.records.empty()) Finish(games);
+      if (record.moves_played != current.records.size() && current.parse_error.empty()) {
+        current.parse_error = "position " + std::to_string(current.records.size()) +
+            " is missing";
+      }
+      current.records.push_back(record);
+      if (record.move < H*W) {
+        current.moves.push_back(FieldMove(record.move));
+      } else if (record.move != DATASET_NO_MOVE && current.parse_error.empty()) {
+        current.parse_error = "position " + std::to_string(record.moves_played) +
+            " has an invalid move";
+      }
+      if (record.moves_played >= MAX_MOVES) Finish(games);
+    }
+    return true;
+  }
+
+private:
+  void Finish(std::vector<Game> *games) {
+    current.location = ++num_games;
+    current.score = current.records.front().score;
+    if (current.parse_error.empty() && current.moves.size() + 1 != current.records.size()) {
+      current.parse_error = "positions and moves don't match";
+    }
+    games->push_back(std::move(current));
+    current = Game();
+  }
+
+  DatasetReader *reader;
+  std::vector<DatasetRecord> block;
+  size_t next = 0;
+  Game current;
+  long long num_games = 0;
+};
+
+// Checks `games` on `jobs` threads.
+void CheckAll(std::vector<Game> &games, int jobs) {
+  std::atomic<size_t> next_game(0);
+  auto work = [&]() {
+    for (;;) {
+      // Claim games in small chunks, to balance the load cheaply.
+      const size_t begin = next_game.fetch_add(256);
+      if (begin >= games.size()) break;
+      const size_t end = std::min(begin + 256, games.size());
+      for (size_t i = begin; i < end; ++i) Check(games[i]);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int i = 1; i < jobs; ++i) threads.emplace_back(work);
+  work();
+  for (std::thread &thread : threads) thread.join();
+}
+
+struct Totals {
+  long long games = 0;
+  long long errors = 0;
+  long long duplicates = 0;
+};
+
+// Checks all games in the file at `path`, and reports the errors and
+// duplicates in order. Returns false if the file can't be read, has no games,
+// or is a dataset with an invalid block. `first_games` maps the CanonicalGameKey() of each
+// complete game seen so far, in any file, to its location.
+bool VerifyFile(const char *path, int jobs,
+    std::unordered_map<uint64_t, std::string> *first_games, Totals *totals) {
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    perror(path);
+    if (fd >= 0) close(fd);
+    return false;
+  }
+  const size_t size = st.st_size;
+  void *data = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : nullptr;
+  close(fd);
+  if (data == MAP_FAILED) {
+    perror(path);
+    return false;
+  }
+  if (data) madvise(data, size, MADV_SEQUENTIAL);
+  DatasetReader dataset;
+  std::unique_ptr<GameReader> reader;
+  const bool is_dataset = size >= sizeof(DATASET_BLOCK_MAGIC) &&
+      memcmp(data, DATASET_BLOCK_MAGIC, sizeof(DATASET_BLOCK_MAGIC)) == 0;
+  if (is_dataset) {
+    if (!dataset.Open(path)) {
+      perror(path);
+      munmap(data, size);
+      return false;
+    }
+    reader.reset(new DatasetGameReader(&dataset));
+  } else if (memchr(data, '\0', size) != nullptr) {
+    printf("%s: neither arbiter output nor a dataset\n", path);
+    munmap(data, size);
+    return false;
+  } else {
+    reader.reset(new TextGameReader(static_cast<const char*>(data), size));
+  }
+  auto location = [&](const Game &game) {
+    return std::string(path) + (is_dataset ? ":game " : ":") + std::to_string(game.location);
+  };
+  const long long games_before = totals->games;
+  std::vector<Game> games;
+  bool more = true;
+  while (more) {
+    games.clear();
+    more = reader->Read(BATCH_GAMES, &games);
+    CheckAll(games, jobs);
+    for (const Game &game : games) {
+      ++totals->games;
+      if (!game.error.empty()) {
+        printf("%s: %s\n", location(game).c_str(), game.error.c_str());
+        ++totals->errors;
+        continue;
+      }
+      // Failed games are often short, and identical for that reason.
+      if (game.moves.size() < size_t(MAX_MOVES)) continue;
+      const auto found = first_games->find(game.key);
+      if (found == first_games->end()) {
+        first_games->emplace(game.key, location(game));
+      } else {
+        printf("%s: duplicate of %s\n", location(game).c_str(), found->second.c_str());
+        ++totals->duplicates;
+      }
+    }
+  }
+  bool ok = true;
+  if (is_dataset && dataset.Error() != nullptr) {
+    // An incomplete block is expected if the writer was interrupted.
+    printf("%s: ignored %zu bytes after the last valid block (%s)\n", path, dataset.Remaining(),
+        dataset.Error());
+    ok = strcmp(dataset.Error(), "incomplete block") == 0;
+  }
+  if (totals->games == games_before) {
+    printf("%s: no games\n", path);
+    ok = false;
+  }
+  if (data) munmap(data, size);
+  return ok;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  int opt_jobs = std::max(1u, std::thread::hardware_concurrency());
+  // Parse option arguments.
+  int j = 1;
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    if (*arg != '-') {
+      argv[j++] = argv[i];
+      continue;
+    }
+    int value = 0;
+    if (sscanf(argv[i], "--jobs=%d", &value) == 1 && value > 0) {
+      opt_jobs = value;
+    } else {
+      fprintf(stderr, "Unrecognized option argument: '%s'!\n", argv[i]);
+    }
+  }
+  argc = j;
+  if (argc < 2) {
+    printf("Usage: verify [--jobs=<N>] <file> [<file> ...]\n"
+        "Each file is either arbiter output, whose game lines are checked, or a\n"
+        "dataset written with the arbiter's --dataset option. Invalid games and\n"
+        "games that repeat an earlier one (up to a symmetry of the board) are\n"
+        "reported one per line. Exits with status 1 if any game is invalid, or a\n"
+        "file has no games or can't be read completely.\n");
+    return 1;
+  }
+  const double start_time = GetMonotonicTime();
+  std::unordered_map<uint64_t, std::string> first_games;
+  Totals totals;
+  bool ok = true;
+  for (int i = 1; i < argc; ++i) {
+    ok = VerifyFile(argv[i], opt_jobs, &first_games, &totals) && ok;
+  }
+  fprintf(stderr, "Checked %lld games in %.3f s: %lld invalid, %lld duplicates.\n",
+      totals.games, GetMonotonicTime() - start_time, totals.errors, totals.duplicates);
+  return ok && totals.errors == 0 ? 0 : 1;
+}
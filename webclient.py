@@ -1,13 +1,75 @@
 #!/usr/bin/python3
 
+import http.client
 import json
+import select
 import socket
 import subprocess
 import sys
+import time
+from urllib.parse import urlsplit
 from urllib.request import urlopen
 
 BASE_URL = 'http://localhost:8027'
 
+class MovePoster:
+    """Posts moves to the server over a single keep-alive connection, which is
+    reopened if the server closes it between moves."""
+
+    def __init__(self, baseUrl):
+        url = urlsplit(baseUrl)
+        self.host = url.hostname
+        self.port = url.port
+        self.path = url.path.rstrip('/') + '/update-game'
+        self.connection = None
+
+    def Connect(self):
+        self.connection = http.client.HTTPConnection(self.host, self.port)
+        self.connection.connect()
+        # Send each small request right away, instead of waiting for an ACK.
+        self.connection.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+
+    def IsStale(self):
+        """Returns whether the server has closed the idle connection: it then
+        reads as ready, at its end, although no response is due."""
+        readable, _, _ = select.select([self.connection.sock], [], [], 0)
+        return bool(readable)
+
+    def Post(self, moveData):
+        body = json.dumps(moveData).encode('utf-8')
+        # The same content type as urlopen() uses for POST data.
+        headers = {'Content-Type': 'application/x-www-form-urlencoded'}
+        if self.connection is not None and self.IsStale():
+            self.Close()
+        if self.connection is None:
+            self.Connect()
+        try:
+            self.connection.request('POST', self.path, body, headers)
+        except ConnectionError:
+            # The request didn't get through, so the move wasn't played: it's
+            # safe to send it again on a new connection.
+            self.Close()
+            self.Connect()
+            self.connection.request('POST', self.path, body, headers)
+        try:
+            # Once the request is sent, the server may have played the move
+            # even if no response arrives, so it isn't sent again.
+            response = self.connection.getresponse()
+            response.read()  # so the connection can be reused
+        except Exception:
+            self.Close()
+            raise
+        if response.status != 200:
+            raise http.client.HTTPException(
+                'update-game failed: {} {}'.format(response.status, response.reason))
+        if response.will_close:
+            self.Close()
+
+    def Close(self):
+        if self.connection is not None:
+            self.connection.close()
+            self.connection = None
+
 def ReadEventStream(f):
     data = b''
     while True:
@@ -49,7 +111,9 @@ if sys.argv[1] not in ('1', '2'):
 myPlayer = int(sys.argv[1])
 commandArgs = sys.argv[2:]
 
-popen = subprocess.Popen(args=commandArgs, stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+# Unbuffered pipes, so each line reaches the other side as soon as it's written.
+popen = subprocess.Popen(args=commandArgs, stdin=subprocess.PIPE, stdout=subprocess.PIPE, bufsize=0)
+poster = MovePoster(BASE_URL)
 for update in ReadEventStream(urlopen(BASE_URL + '/game-updates')):
     update = json.loads(update)
     if update['mode'] == 'move' and update['state']['public']['nextPlayer'] == myPlayer:
@@ -59,11 +123,12 @@ for update in ReadEventStream(urlopen(BASE_URL + '/game-updates')):
             lastMove = FormatCaiaMove(row, col)
         else:
             lastMove = 'Start'
+        startTime = time.monotonic()
         popen.stdin.write((lastMove + '\n').encode('utf-8'))
-        popen.stdin.flush()
 
         # Read my player's move.
         move = popen.stdout.readline().decode('utf-8').strip()
+        engineTime = time.monotonic() - startTime
         row, col = ParseCaiaMove(move)
         moveData = {
             'action': 'move',
@@ -71,4 +136,9 @@ for update in ReadEventStream(urlopen(BASE_URL + '/game-updates')):
             'move': [row, col]}
 
         # Send my player's move to the server.
-        urlopen(BASE_URL + '/update-game', json.dumps(moveData).encode('utf-8'))
+        postStartTime = time.monotonic()
+        poster.Post(moveData)
+        endTime = time.monotonic()
+        networkTime = endTime - postStartTime
+        print('move={} engine={:.3f}s network={:.3f}s total={:.3f}s'.format(
+            move, engineTime, networkTime, endTime - startTime), file=sys.stderr, flush=True)